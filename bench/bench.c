@@ -0,0 +1,214 @@
+/*
+ * Benchmark runner for `make bench`
+ *
+ * Runs light-status on one producer command until the producer is done,
+ * then matches the producer's write times against light-status' frame
+ * trace and prints one JSON object:
+ *
+ *   lines_per_sec   lines on the screen per second, from the first write to the last frame
+ *   latency_*_us    from a line being written to the first frame that showed it or a newer one
+ *   cpu_*_s         light-status' own CPU time, without the producer's
+ *   peak_rss_kb     light-status' peak resident memory
+ *
+ * bench --bin <light-status> --producer <producer> --mix <mix> --rate <lines/s>
+ *       --lines <count> [--dir <tmp dir>] [-- <light-status flags>...]
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+typedef struct TraceRecord {
+    char kind;  // 'f' for a frame, 's' for a skipped repeated line
+    uint64_t lines_read;
+    uint64_t at;
+} TraceRecord;
+
+
+static int
+compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t
+percentile(const uint64_t *sorted, size_t len, double p)
+{
+    if (!len)
+        return 0;
+    size_t i = (size_t)(p * (len - 1) + 0.5);
+    return sorted[i < len ? i : len - 1];
+}
+
+static uint64_t *
+read_writes(const char *path, size_t *len, uint64_t *producer_user_us, uint64_t *producer_sys_us)
+{
+    FILE *file = fopen(path, "r");
+    size_t size = 1024;
+    uint64_t *writes = malloc(size * sizeof(uint64_t));
+    uint64_t value;
+
+    *len = 0;
+    if (!file || !writes || fscanf(file, "cpu_us %" SCNu64 " %" SCNu64, producer_user_us, producer_sys_us) != 2) {
+        fprintf(stderr, "bench: cannot read the producer log '%s'\n", path);
+        exit(1);
+    }
+    while (fscanf(file, "%" SCNu64, &value) == 1) {
+        if (*len == size && !(writes = realloc(writes, (size *= 2) * sizeof(uint64_t))))
+            exit(1);
+        writes[(*len)++] = value;
+    }
+    fclose(file);
+    return writes;
+}
+
+static TraceRecord *
+read_trace(const char *path, size_t *len)
+{
+    FILE *file = fopen(path, "r");
+    size_t size = 1024;
+    TraceRecord *records = malloc(size * sizeof(TraceRecord));
+    TraceRecord record;
+
+    *len = 0;
+    if (!file || !records) {
+        fprintf(stderr, "bench: cannot read the trace '%s'\n", path);
+        exit(1);
+    }
+    while (fscanf(file, " %c %" SCNu64 " %" SCNu64, &record.kind, &record.lines_read, &record.at) == 3) {
+        if (*len == size && !(records = realloc(records, (size *= 2) * sizeof(TraceRecord))))
+            exit(1);
+        records[(*len)++] = record;
+    }
+    fclose(file);
+    return records;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *bin = NULL, *producer = NULL, *mix = "ascii", *rate = "0", *lines = "10000";
+    const char *dir = "/tmp";
+    int extra = argc;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--")) {
+            extra = i + 1;
+            break;
+        }
+        if (i + 1 >= argc)
+            break;
+        if (!strcmp(argv[i], "--bin"))
+            bin = argv[++i];
+        else if (!strcmp(argv[i], "--producer"))
+            producer = argv[++i];
+        else if (!strcmp(argv[i], "--mix"))
+            mix = argv[++i];
+        else if (!strcmp(argv[i], "--rate"))
+            rate = argv[++i];
+        else if (!strcmp(argv[i], "--lines"))
+            lines = argv[++i];
+        else if (!strcmp(argv[i], "--dir"))
+            dir = argv[++i];
+    }
+    if (!bin || !producer) {
+        fprintf(stderr, "bench: --bin and --producer are required\n");
+        return 1;
+    }
+
+    char log_path[4096], trace_path[4096], command[8192];
+    snprintf(log_path, sizeof(log_path), "%s/light-status-bench-%d.producer", dir, (int)getpid());
+    snprintf(trace_path, sizeof(trace_path), "%s/light-status-bench-%d.trace", dir, (int)getpid());
+    snprintf(
+        command, sizeof(command), "'%s' --mix '%s' --rate '%s' --lines '%s' --log '%s'",
+        producer, mix, rate, lines, log_path
+    );
+
+    /* quit as soon as the producer is done instead of restarting it */
+    const char **args = calloc(argc - extra + 6, sizeof(char *));
+    int args_len = 0;
+    args[args_len++] = bin;
+    args[args_len++] = "-R";
+    args[args_len++] = "0";
+    args[args_len++] = "-i";
+    args[args_len++] = command;
+    for (int i = extra; i < argc; i++)
+        args[args_len++] = argv[i];
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        /* light-status signals its whole process group when it is stopped */
+        setpgid(0, 0);
+        setenv("LIGHT_STATUS_TRACE", trace_path, 1);
+        execv(bin, (char *const *)args);
+        perror("execv");
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) < 0)
+        if (errno != EINTR) {
+            perror("wait4");
+            return 1;
+        }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "bench: light-status did not exit cleanly\n");
+        return 1;
+    }
+
+    uint64_t producer_user_us, producer_sys_us;
+    size_t writes_len, trace_len;
+    uint64_t *writes = read_writes(log_path, &writes_len, &producer_user_us, &producer_sys_us);
+    TraceRecord *trace = read_trace(trace_path, &trace_len);
+    unlink(log_path);
+    unlink(trace_path);
+
+    /* every line is shown by the first record that counts it as read */
+    uint64_t *latencies = malloc((writes_len + 1) * sizeof(uint64_t));
+    size_t latencies_len = 0, frames = 0, r = 0;
+    uint64_t last_shown = 0;
+    for (size_t i = 0; i < trace_len; i++)
+        frames += trace[i].kind == 'f';
+    for (size_t n = 0; n < writes_len; n++) {
+        while (r < trace_len && trace[r].lines_read < n + 1)
+            r++;
+        if (r == trace_len)
+            break;
+        latencies[latencies_len++] = trace[r].at > writes[n] ? trace[r].at - writes[n] : 0;
+        last_shown = trace[r].at;
+    }
+    qsort(latencies, latencies_len, sizeof(uint64_t), compare_u64);
+
+    double elapsed_s = writes_len && last_shown > writes[0] ? (last_shown - writes[0]) / 1e9 : 0;
+    /* the producer is waited for by light-status, its time is split off each field */
+    double user_s = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 - producer_user_us / 1e6;
+    double sys_s = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6 - producer_sys_us / 1e6;
+    user_s = user_s > 0 ? user_s : 0;
+    sys_s = sys_s > 0 ? sys_s : 0;
+
+    printf(
+        "{\"mix\": \"%s\", \"rate\": %s, \"lines\": %zu, \"lines_shown\": %zu, \"frames\": %zu, "
+        "\"lines_per_sec\": %.1f, \"latency_p50_us\": %.1f, \"latency_p99_us\": %.1f, "
+        "\"latency_max_us\": %.1f, \"cpu_user_s\": %.3f, \"cpu_sys_s\": %.3f, \"peak_rss_kb\": %ld}\n",
+        mix, rate, writes_len, latencies_len, frames,
+        elapsed_s > 0 ? latencies_len / elapsed_s : 0,
+        percentile(latencies, latencies_len, 0.5) / 1e3,
+        percentile(latencies, latencies_len, 0.99) / 1e3,
+        latencies_len ? latencies[latencies_len - 1] / 1e3 : 0,
+        user_s, sys_s, usage.ru_maxrss
+    );
+    fflush(stdout);
+    return 0;
+}
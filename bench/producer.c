@@ -0,0 +1,216 @@
+/*
+ * Synthetic status line producer for `make bench`
+ *
+ * Writes a mix of line kinds at a given rate and, once done, logs when each
+ * line was written so the runner can match them against light-status' trace.
+ *
+ * producer --mix <kind>[:<weight>][,...] --rate <lines/s, 0 for no limit>
+ *          --lines <count> --log <path>
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#define LINE_MAX_LEN 4096
+#define LONG_LINE_LEN 2000
+
+typedef enum Kind {
+    KIND_ASCII,
+    KIND_ICONS,
+    KIND_CJK,
+    KIND_SAME,
+    KIND_LONG,
+    KIND_LEN,
+} Kind;
+
+static const char *kind_names[KIND_LEN] = {"ascii", "icons", "cjk", "same", "long"};
+
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* xorshift, the same mix gives the same lines on every run */
+static uint32_t
+next_random(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static int
+parse_mix(const char *mix, unsigned int weights[KIND_LEN])
+{
+    unsigned int total = 0;
+
+    memset(weights, 0, KIND_LEN * sizeof(unsigned int));
+    while (*mix) {
+        size_t len = strcspn(mix, ":,");
+        int kind;
+
+        for (kind = 0; kind < KIND_LEN; kind++)
+            if (strlen(kind_names[kind]) == len && !strncmp(mix, kind_names[kind], len))
+                break;
+        if (kind == KIND_LEN) {
+            fprintf(stderr, "producer: unknown line kind '%.*s'\n", (int)len, mix);
+            return -1;
+        }
+        mix += len;
+
+        unsigned int weight = 1;
+        if (*mix == ':') {
+            weight = strtoul(mix + 1, (char **)&mix, 10);
+        }
+        weights[kind] += weight;
+        total += weight;
+        if (*mix == ',')
+            mix++;
+    }
+    return total ? (int)total : -1;
+}
+
+static size_t
+make_line(Kind kind, uint64_t seq, uint32_t *random, char *line, size_t prev_len)
+{
+    unsigned int a = next_random(random) % 100;
+    unsigned int b = next_random(random) % 100;
+    unsigned int s = seq % 60;
+    int len = 0;
+
+    switch (kind) {
+        case KIND_ASCII:
+            len = snprintf(
+                line, LINE_MAX_LEN, "cpu %2u%% | mem %u.%uG | vol %2u%% | 12:%02u:%02u",
+                a, b / 10, b % 10, b, (unsigned int)(seq / 60 % 60), s
+            );
+            break;
+        case KIND_ICONS:
+            /* private use area glyphs as icon fonts have them, and emoji */
+            len = snprintf(
+                line, LINE_MAX_LEN,
+                "\xef\x8b\x9b %2u%% \xef\x94\xb8 %u.%uG \xef\x80\xa8 %2u%% \xe2\x9a\xa1 %2u%% \xf0\x9f\x94\x8b 12:%02u",
+                a, b / 10, b % 10, b, a, s
+            );
+            break;
+        case KIND_CJK:
+            len = snprintf(
+                line, LINE_MAX_LEN,
+                "\xe9\x9f\xb3\xe9\x87\x8f %2u%% \xe5\xa4\xa9\xe6\xb0\x97 \xe6\x99\xb4\xe3\x82\x8c "
+                "\xea\xb8\xb0\xec\x98\xa8 %u\xe2\x84\x83 12:%02u",
+                a, b % 40, s
+            );
+            break;
+        case KIND_SAME:
+            /* the previous line again, the first one is empty */
+            return prev_len;
+        case KIND_LONG:
+            for (len = 0; len < LONG_LINE_LEN; len++)
+                line[len] = 'a' + (next_random(random) % 26);
+            len += snprintf(line + len, LINE_MAX_LEN - len, " %" PRIu64, seq);
+            break;
+        case KIND_LEN:
+            break;
+    }
+    return len;
+}
+
+static int
+write_all(const char *data, size_t len)
+{
+    while (len) {
+        ssize_t written = write(STDOUT_FILENO, data, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += written;
+        len -= written;
+    }
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *mix = "ascii";
+    const char *log_path = NULL;
+    double rate = 0;
+    uint64_t lines = 10000;
+    unsigned int weights[KIND_LEN];
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--mix"))
+            mix = argv[i + 1];
+        else if (!strcmp(argv[i], "--rate"))
+            rate = atof(argv[i + 1]);
+        else if (!strcmp(argv[i], "--lines"))
+            lines = strtoull(argv[i + 1], NULL, 10);
+        else if (!strcmp(argv[i], "--log"))
+            log_path = argv[i + 1];
+    }
+
+    int total = parse_mix(mix, weights);
+    if (total < 0 || !log_path || !lines)
+        return 1;
+
+    uint64_t *written_at = malloc(lines * sizeof(uint64_t));
+    char *line = calloc(LINE_MAX_LEN + 1, 1);
+    size_t len = 0;
+    uint32_t random = 0x12345678;
+    uint64_t start = now_ns();
+    uint64_t interval = rate > 0 ? (uint64_t)(1e9 / rate) : 0;
+    if (!written_at || !line)
+        return 1;
+
+    for (uint64_t seq = 0; seq < lines; seq++) {
+        if (interval) {
+            uint64_t due = start + seq * interval;
+            struct timespec ts = {.tv_sec = due / 1000000000, .tv_nsec = due % 1000000000};
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+                ; /* NOP */
+        }
+
+        unsigned int pick = next_random(&random) % total;
+        Kind kind = 0;
+        while (pick >= weights[kind])
+            pick -= weights[kind++];
+
+        len = make_line(kind, seq, &random, line, len);
+        line[len] = '\n';
+        /* before the write: a full pipe blocks it until light-status has read and maybe drawn the line */
+        written_at[seq] = now_ns();
+        if (write_all(line, len + 1) != 0)
+            return 1;
+    }
+
+    /* light-status waits for this process, so its CPU time would count as its own */
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    FILE *log = fopen(log_path, "w");
+    if (!log)
+        return 1;
+    fprintf(
+        log, "cpu_us %" PRIu64 " %" PRIu64 "\n",
+        (uint64_t)usage.ru_utime.tv_sec * 1000000 + usage.ru_utime.tv_usec,
+        (uint64_t)usage.ru_stime.tv_sec * 1000000 + usage.ru_stime.tv_usec
+    );
+    for (uint64_t seq = 0; seq < lines; seq++)
+        fprintf(log, "%" PRIu64 "\n", written_at[seq]);
+    fclose(log);
+    return 0;
+}
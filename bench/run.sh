@@ -0,0 +1,45 @@
+#!/bin/sh
+# Runs the benchmark scenarios on a private Xvfb display, one JSON line each
+#
+# usage: run.sh <light-status> <bench> <producer>
+#
+# BENCH_MIXES  space separated line mixes, each <kind>[:<weight>][,...] of
+#              ascii, icons, cjk, same and long
+# BENCH_RATE   lines per second the producer writes, 0 for as fast as it can
+# BENCH_LINES  lines per scenario
+# BENCH_ARGS   more light-status flags, e.g. "-F 60" or "-Xs 1"
+
+set -e
+
+bin=$1
+bench=$2
+producer=$3
+mixes=${BENCH_MIXES:-"ascii icons cjk same long ascii:4,icons:2,cjk:1,same:2,long:1"}
+
+command -v Xvfb >/dev/null || { echo "bench: Xvfb is needed" >&2; exit 1; }
+
+# Xvfb picks a free display itself and writes its number once it is ready,
+# so a server already running somewhere is never used by mistake
+ready=$(mktemp)
+Xvfb -displayfd 3 -screen 0 1920x1080x24 -nolisten tcp 3>"$ready" >/dev/null 2>&1 &
+xvfb=$!
+trap 'kill $xvfb 2>/dev/null; rm -f "$ready"' EXIT INT TERM
+
+i=0
+while [ ! -s "$ready" ]; do
+    i=$((i + 1))
+    if [ $i -gt 100 ] || ! kill -0 $xvfb 2>/dev/null; then
+        echo "bench: Xvfb did not start" >&2
+        exit 1
+    fi
+    sleep 0.05
+done
+display=":$(head -n 1 "$ready")"
+
+export DISPLAY="$display"
+for mix in $mixes; do
+    # shellcheck disable=SC2086
+    "$bench" --bin "$bin" --producer "$producer" \
+        --mix "$mix" --rate "${BENCH_RATE:-0}" --lines "${BENCH_LINES:-20000}" \
+        -- $BENCH_ARGS
+done
@@ -0,0 +1,259 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "collectors.h"
+#include "util.h"
+
+
+#define SYSFS_PATH_MAX 256
+
+
+/* Re-read a whole procfs/sysfs file through a descriptor opened once */
+static int
+read_file(int fd, char *buf, size_t size)
+{
+    ssize_t len = pread(fd, buf, size - 1, 0);
+
+    if (len < 0)
+        len = 0;
+    buf[len] = '\0';
+    return len;
+}
+
+static int
+collect_clock(Collector *collector, char *out, size_t size)
+{
+    time_t now = time(NULL);
+    struct tm tm;
+
+    localtime_r(&now, &tm);
+    return strftime(out, size, collector->arg ? collector->arg : "%H:%M:%S", &tm);
+}
+
+static void
+read_cpu_times(Collector *collector, uint64_t *busy, uint64_t *total)
+{
+    char buf[256];
+    uint64_t user = 0, nice = 0, system = 0, idle = 0, iowait = 0, irq = 0, softirq = 0, steal = 0;
+
+    read_file(collector->fds[0], buf, sizeof(buf));
+    sscanf(
+        buf, "cpu %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+        " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64,
+        &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal
+    );
+
+    *busy = user + nice + system + irq + softirq + steal;
+    *total = *busy + idle + iowait;
+}
+
+static int
+collect_cpu(Collector *collector, char *out, size_t size)
+{
+    uint64_t busy, total;
+
+    read_cpu_times(collector, &busy, &total);
+    uint64_t d_busy = busy - collector->prev_busy;
+    uint64_t d_total = total - collector->prev_total;
+
+    /* too soon after the previous sample to tell, the last reading stands and
+     * the next sample covers both */
+    if (d_total) {
+        collector->prev_busy = busy;
+        collector->prev_total = total;
+        snprintf(collector->cpu_text, sizeof(collector->cpu_text), "%d%%", (int)(d_busy * 100 / d_total));
+    }
+    return snprintf(out, size, "%s", collector->cpu_text);
+}
+
+static int
+collect_mem(Collector *collector, char *out, size_t size)
+{
+    char buf[4096];
+    uint64_t total = 0, available = 0;
+    char *field;
+
+    read_file(collector->fds[0], buf, sizeof(buf));
+    if ((field = strstr(buf, "MemTotal:")))
+        sscanf(field, "MemTotal: %" SCNu64, &total);
+    if ((field = strstr(buf, "MemAvailable:")))
+        sscanf(field, "MemAvailable: %" SCNu64, &available);
+
+    return snprintf(out, size, "%d%%", total ? (int)((total - available) * 100 / total) : 0);
+}
+
+static int
+collect_load(Collector *collector, char *out, size_t size)
+{
+    char buf[128];
+    double load1 = 0, load5 = 0, load15 = 0;
+
+    read_file(collector->fds[0], buf, sizeof(buf));
+    sscanf(buf, "%lf %lf %lf", &load1, &load5, &load15);
+
+    return snprintf(out, size, "%.2f %.2f %.2f", load1, load5, load15);
+}
+
+static int
+collect_battery(Collector *collector, char *out, size_t size)
+{
+    char capacity[16];
+    char status[32];
+
+    read_file(collector->fds[0], capacity, sizeof(capacity));
+    read_file(collector->fds[1], status, sizeof(status));
+
+    return snprintf(
+        out, size, "%d%%%s",
+        atoi(capacity),
+        strncmp(status, "Charging", 8) == 0 ? "+" : ""
+    );
+}
+
+static int
+collect_thermal(Collector *collector, char *out, size_t size)
+{
+    char buf[32];
+
+    read_file(collector->fds[0], buf, sizeof(buf));
+    return snprintf(out, size, "%d°C", atoi(buf) / 1000);
+}
+
+static int
+open_file(const char *fmt, const char *arg)
+{
+    char path[SYSFS_PATH_MAX];
+
+    snprintf(path, sizeof(path), fmt, arg);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        fprintf(stderr, "error, cannot open '%s'\n", path);
+    return fd;
+}
+
+static bool
+spec_is(const char *spec, size_t name_len, const char *name)
+{
+    return strlen(name) == name_len && strncmp(spec, name, name_len) == 0;
+}
+
+Collector *
+collector_create(const char *spec)
+{
+    Collector *collector = ecalloc(1, sizeof(Collector));
+    size_t name_len = strcspn(spec, ":");
+
+    collector->fds[0] = collector->fds[1] = -1;
+    collector->arg = spec[name_len] == ':' ? spec + name_len + 1 : NULL;
+
+    if (spec_is(spec, name_len, "clock")) {
+        collector->collect = collect_clock;
+    } else if (spec_is(spec, name_len, "cpu")) {
+        collector->collect = collect_cpu;
+        collector->fds[0] = open_file("/proc/stat", NULL);
+        /* the counters start at boot, the first update shows the usage since now instead */
+        if (collector->fds[0] >= 0)
+            read_cpu_times(collector, &collector->prev_busy, &collector->prev_total);
+    } else if (spec_is(spec, name_len, "mem")) {
+        collector->collect = collect_mem;
+        collector->fds[0] = open_file("/proc/meminfo", NULL);
+    } else if (spec_is(spec, name_len, "load")) {
+        collector->collect = collect_load;
+        collector->fds[0] = open_file("/proc/loadavg", NULL);
+    } else if (spec_is(spec, name_len, "battery")) {
+        collector->collect = collect_battery;
+        collector->arg = collector->arg ? collector->arg : "BAT0";
+        collector->fds[0] = open_file("/sys/class/power_supply/%s/capacity", collector->arg);
+        collector->fds[1] = open_file("/sys/class/power_supply/%s/status", collector->arg);
+    } else if (spec_is(spec, name_len, "thermal")) {
+        collector->collect = collect_thermal;
+        collector->arg = collector->arg ? collector->arg : "thermal_zone0";
+        collector->fds[0] = open_file("/sys/class/thermal/%s/temp", collector->arg);
+    } else {
+        fprintf(stderr, "error, unknown built-in source: '%.*s'\n", (int)name_len, spec);
+        free(collector);
+        return NULL;
+    }
+
+    if (collector->collect != collect_clock && collector->fds[0] < 0) {
+        collector_free(collector);
+        return NULL;
+    }
+    return collector;
+}
+
+int
+collector_collect(Collector *collector, char *out, size_t size)
+{
+    return collector->collect(collector, out, size);
+}
+
+void
+collector_free(Collector *collector)
+{
+    if (!collector)
+        return;
+    for (int i = 0; i < 2; i++)
+        if (collector->fds[i] >= 0)
+            close(collector->fds[i]);
+    free(collector);
+}
+
+/* tick on wall clock boundaries so a clock flips right when the second does */
+static int
+timer_arm(int fd, unsigned int interval_ms)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t now_ms = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    uint64_t first_ms = (now_ms / interval_ms + 1) * interval_ms;
+
+    struct itimerspec spec = {
+        .it_interval = {
+            .tv_sec = interval_ms / 1000,
+            .tv_nsec = (interval_ms % 1000) * 1000000L,
+        },
+        .it_value = {
+            .tv_sec = first_ms / 1000,
+            .tv_nsec = (first_ms % 1000) * 1000000L,
+        },
+    };
+    /* a wall clock set backwards would otherwise hold the timer until it caught up */
+    return timerfd_settime(fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, NULL);
+}
+
+int
+collectors_timer_create(unsigned int interval_ms)
+{
+    int fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    if (timer_arm(fd, interval_ms) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool
+collectors_timer_read(int fd, unsigned int interval_ms)
+{
+    uint64_t expirations;
+
+    if (read(fd, &expirations, sizeof(expirations)) > 0)
+        return true;
+    if (errno != ECANCELED)
+        return false;
+    /* the clock was set, the time shown is off until the next update */
+    timer_arm(fd, interval_ms);
+    return true;
+}
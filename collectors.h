@@ -0,0 +1,60 @@
+#ifndef COLLECTORS_H
+#define COLLECTORS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* the longest string a collector produces */
+#define COLLECTOR_TEXT_SIZE 256
+
+/* A built-in data source that formats one status string per update */
+typedef struct Collector {
+    int (*collect)(struct Collector *collector, char *out, size_t size);
+    const char *arg;
+    int fds[2];  // kept open between updates and re-read with pread()
+    uint64_t prev_busy, prev_total;
+    char cpu_text[8];  // the last cpu reading, empty before the first one
+} Collector;
+
+/**
+ * Create a collector from a command line spec
+ * 
+ * @param spec <name>[:<arg>], see print_help for the names
+ * @return The collector or NULL if the name is unknown or its files can not be opened
+ */
+Collector *collector_create(const char *spec);
+
+/**
+ * Format the current value of the collector
+ * 
+ * @param collector The collector to update
+ * @param out The buffer to write the string to
+ * @param size The size of out
+ * @return The length of the string written to out
+ */
+int collector_collect(Collector *collector, char *out, size_t size);
+
+void collector_free(Collector *collector);
+
+/**
+ * Create a timerfd firing every interval_ms, aligned to wall clock multiples of the interval
+ * 
+ * @param interval_ms The update interval
+ * @return The timer fd or -1 on error
+ */
+int collectors_timer_create(unsigned int interval_ms);
+
+/**
+ * Take the expirations of a timer from collectors_timer_create
+ * 
+ * A change of the wall clock cancels the timer; it is armed again on the
+ * next boundary then, and the sources are due right away.
+ * 
+ * @param fd The timer fd, readable
+ * @param interval_ms The interval it was created with
+ * @return true if the sources are due
+ */
+bool collectors_timer_read(int fd, unsigned int interval_ms);
+
+#endif /* COLLECTORS_H */
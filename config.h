@@ -3,8 +3,29 @@
 // undef to stop handling cmdline arguments
 #define USE_ARGS
 
+// longer lines are cut, shorter ones are read whole however long they are
 uint32_t
-    max_status_len = 2048;
+    max_status_len = 1 << 20;
+
+// 0 draws every line; otherwise lines arriving faster are coalesced, newest wins
+unsigned int max_fps = 0;
+
+// frames are sent without waiting for the X server; above this many unconfirmed ones,
+// new lines wait and are coalesced, which matters for slow remote displays; 0 never waits
+unsigned int max_pending_frames = 0;
+
+// draw the panel on the client into memory shared with a local X server (needs USE_XSHM in
+// config.mk); remote displays fall back to drawing on the server
+int client_rendering = 0;
+
+// the window follows its text plus autosize_padding on every side, panel_rect's size is
+// the largest it gets; its width grows in steps of autosize_step pixels, and it shrinks
+// only once the text has stayed smaller for autosize_shrink_ms, so jittering widths do
+// not resize it
+int autosize = 0;
+unsigned int autosize_padding = 8;
+unsigned int autosize_step = 32;
+unsigned int autosize_shrink_ms = 3000;
 
 Rect panel_rect = {
     .x = 0,
@@ -31,6 +52,21 @@ Alignment text_alignment = {
 const char *default_fonts[] = {"monospace:size=20"};
 const char default_text_color[] = "#ffffff";
 const char default_background_color[] = "#000000";
+// the last line of a stopped command while it waits to be restarted, NULL draws it like any other
+const char *default_stale_text_color = NULL;
+
+// ^fg(<color>), ^bg(<color>) and ^fn(<index>) in the text switch colors and fonts for the
+// text after them, empty parentheses switch back; ^^ draws a caret. Off by default, so
+// lines that happen to hold a ^ are drawn as they are
+int text_markup = 0;
+
+// how often the built-in sources (-B) are updated
+unsigned int builtin_interval_ms = 1000;
+
+// a command that stops is started again after this many ms, doubling while it keeps
+// exiting quickly up to restart_max_delay_ms; 0 quits once all commands have stopped
+unsigned int restart_delay_ms = 500;
+unsigned int restart_max_delay_ms = 30000;
 
 // should repeatedly put a string witn \n at the end
 const char default_status_collecting_command[] = "/usr/local/bin/slstatus -s";
@@ -39,3 +75,7 @@ char default_window_class[] = "light-status";
 
 int monitor = MONITOR_FOCUSED;
 
+// with the monitor set to MONITOR_ACTIVE (-Xm A) panels move to the monitor of the active
+// window; focus changes closer together than this are looked up once
+unsigned int follow_interval_ms = 250;
+
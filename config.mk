@@ -37,5 +37,13 @@ LDFLAGS = \
 DEFFLAGS += -DUSE_XINERAMA
 LDFLAGS += -lXinerama
 
+# RandR, follows monitors being plugged in and out, comment if you don't want it
+DEFFLAGS += -DUSE_XRANDR
+LDFLAGS += -lXrandr
+
+# MIT-SHM client side rendering (-Xs), comment if you don't want it
+DEFFLAGS += -DUSE_XSHM
+LDFLAGS += -lXext
+
 # compiler and linker
 CC = clang
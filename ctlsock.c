@@ -0,0 +1,136 @@
+/* accept4 */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "ctlsock.h"
+
+
+static int
+ctlsock_address(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "error, socket path is too long: '%s'\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+int
+ctlsock_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd;
+
+    if (ctlsock_address(path, &addr) != 0)
+        return -1;
+
+    /* a socket left behind by an instance that was killed refuses connections, a live one is kept */
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+            perror("socket");
+            return -1;
+        }
+        int connected = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+        int error = errno;
+        close(fd);
+        if (connected == 0) {
+            fprintf(stderr, "error, another instance is listening on '%s'\n", path);
+            return -1;
+        }
+        if (error != ECONNREFUSED) {
+            fprintf(stderr, "error, cannot check the socket '%s': %s\n", path, strerror(error));
+            return -1;
+        }
+        unlink(path);
+    }
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+        perror("socket");
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        fprintf(stderr, "error, cannot listen on '%s': %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int
+ctlsock_accept(int listen_fd)
+{
+    int fd;
+
+    /* like the listening socket, clients must not leak into restarted commands */
+    do {
+        fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    } while (fd < 0 && errno == EINTR);
+    return fd;
+}
+
+static int
+write_all(int fd, const char *data, size_t len)
+{
+    while (len) {
+        ssize_t written = send(fd, data, len, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += written;
+        len -= written;
+    }
+    return 0;
+}
+
+int
+ctlsock_send(const char *path, int words_len, const char *words[])
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (ctlsock_address(path, &addr) != 0)
+        return 1;
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        perror("socket");
+        return 1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "error, cannot connect to '%s': %s\n", path, strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    int failed = 0;
+    if (words_len) {
+        for (int i = 0; i < words_len && !failed; i++) {
+            failed = (i && write_all(fd, " ", 1) != 0)
+                || write_all(fd, words[i], strlen(words[i])) != 0;
+        }
+        failed = failed || write_all(fd, "\n", 1) != 0;
+    } else {
+        char buf[4096];
+        ssize_t len;
+        while (!failed && ((len = read(STDIN_FILENO, buf, sizeof(buf))) > 0 || (len < 0 && errno == EINTR)))
+            if (len > 0)
+                failed = write_all(fd, buf, len) != 0;
+    }
+
+    if (failed)
+        perror("send");
+    close(fd);
+    return failed;
+}
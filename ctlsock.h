@@ -0,0 +1,34 @@
+#ifndef CTLSOCK_H
+#define CTLSOCK_H
+
+/**
+ * Create a listening AF_UNIX stream socket, replacing a stale one at path
+ * 
+ * @param path The socket path
+ * @return The non-blocking listening fd or -1 on error
+ */
+int ctlsock_listen(const char *path);
+
+/**
+ * Accept one pending client
+ * 
+ * @param listen_fd The fd returned by ctlsock_listen
+ * @return The non-blocking client fd or -1 if there is none
+ */
+int ctlsock_accept(int listen_fd);
+
+/**
+ * Sender mode: push status lines to a running instance
+ * 
+ * The words are joined with spaces and sent as one line. Without words,
+ * standard input is forwarded until it ends, so a long-lived producer can
+ * pipe into a single sender.
+ * 
+ * @param path The socket path the instance listens on
+ * @param words_len The number of words
+ * @param words The words of the line
+ * @return The process exit code
+ */
+int ctlsock_send(const char *path, int words_len, const char *words[]);
+
+#endif /* CTLSOCK_H */
@@ -6,6 +6,8 @@
 #include <X11/Xft/Xft.h>
 
 #include "drw.h"
+#include "fontdisk.h"
+#include "stats.h"
 #include "util.h"
 
 #define UTF_INVALID 0xFFFD
@@ -58,6 +60,59 @@ utf8decode(const char * c, long *u)
 	return len;
 }
 
+static void
+fontcache_clear(FontCache *cache)
+{
+	size_t i;
+
+	for (i = 0; i < FONTCACHE_PAGES; i++) {
+		free(cache->bmp[i]);
+		cache->bmp[i] = NULL;
+	}
+	free(cache->astral);
+	cache->astral = NULL;
+	cache->astral_size = cache->astral_len = 0;
+}
+
+static Fnt **
+fontcache_slot(FontCache *cache, unsigned int codepoint)
+{
+	FontCacheEntry *old;
+	size_t i, j, mask, oldsize;
+
+	if (codepoint < 0x10000) {
+		i = codepoint >> FONTCACHE_PAGE_BITS;
+		if (!cache->bmp[i])
+			cache->bmp[i] = ecalloc(1 << FONTCACHE_PAGE_BITS, sizeof(Fnt *));
+		return &cache->bmp[i][codepoint & ((1 << FONTCACHE_PAGE_BITS) - 1)];
+	}
+
+	/* keep the load under 3/4 so probing stays short */
+	if ((cache->astral_len + 1) * 4 > cache->astral_size * 3) {
+		old = cache->astral;
+		oldsize = cache->astral_size;
+		cache->astral_size = oldsize ? oldsize * 2 : 64;
+		cache->astral = ecalloc(cache->astral_size, sizeof(FontCacheEntry));
+		mask = cache->astral_size - 1;
+		for (i = 0; i < oldsize; i++) {
+			if (!old[i].codepoint)
+				continue;
+			for (j = (old[i].codepoint * 2654435761u) & mask; cache->astral[j].codepoint; j = (j + 1) & mask)
+				; /* NOP */
+			cache->astral[j] = old[i];
+		}
+		free(old);
+	}
+
+	mask = cache->astral_size - 1;
+	for (i = (codepoint * 2654435761u) & mask; cache->astral[i].codepoint; i = (i + 1) & mask)
+		if (cache->astral[i].codepoint == codepoint)
+			return &cache->astral[i].font;
+	cache->astral[i].codepoint = codepoint;
+	cache->astral_len++;
+	return &cache->astral[i].font;
+}
+
 Drw *
 drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h)
 {
@@ -69,6 +124,9 @@ drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h
 	drw->w = w;
 	drw->h = h;
 	drw->drawable = XCreatePixmap(dpy, root, w, h, DefaultDepth(dpy, screen));
+	drw->xftdraw = XftDrawCreate(dpy, drw->drawable,
+	                             DefaultVisual(dpy, screen),
+	                             DefaultColormap(dpy, screen));
 	drw->gc = XCreateGC(dpy, root, 0, NULL);
 	XSetLineAttributes(dpy, drw->gc, 1, LineSolid, CapButt, JoinMiter);
 
@@ -86,14 +144,57 @@ drw_resize(Drw *drw, unsigned int w, unsigned int h)
 	if (drw->drawable)
 		XFreePixmap(drw->dpy, drw->drawable);
 	drw->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, DefaultDepth(drw->dpy, drw->screen));
+	XftDrawChange(drw->xftdraw, drw->drawable);
+	if (drw->shm && !shmimage_resize(drw->shm, w, h)) {
+		shmimage_free(drw->shm);
+		drw->shm = NULL;
+	}
+}
+
+/* Draw on the client into an image shared with the server from now on.
+ * Returns 0 if the display does not allow it, drawing stays on the server
+ * then. */
+int
+drw_shm_enable(Drw *drw)
+{
+	if (!drw)
+		return 0;
+	if (!drw->shm)
+		drw->shm = shmimage_create(drw->dpy, drw->screen, drw->w, drw->h);
+	return drw->shm != NULL;
+}
+
+/* Returns 1 if the event belonged to the Drw */
+int
+drw_handle_event(Drw *drw, XEvent *ev)
+{
+	return drw && drw->shm && shmimage_handle_event(drw->shm, ev);
 }
 
 void
 drw_free(Drw *drw)
 {
+	ClrEntry *e, *next;
+	size_t i;
+
+	for (i = 0; i < CLRCACHE_BUCKETS; i++) {
+		for (e = drw->colors[i]; e; e = next) {
+			next = e->next;
+			if (e->ok)
+				XftColorFree(drw->dpy, DefaultVisual(drw->dpy, drw->screen),
+				             DefaultColormap(drw->dpy, drw->screen), &e->color);
+			free(e->name);
+			free(e);
+		}
+	}
+	shmimage_free(drw->shm);
+	XftDrawDestroy(drw->xftdraw);
 	XFreePixmap(drw->dpy, drw->drawable);
 	XFreeGC(drw->dpy, drw->gc);
 	drw_fontset_free(drw->fonts);
+	fontcache_clear(&drw->fontcache);
+	free(drw->specs);
+	drw_layout_free(&drw->scratch);
 	free(drw);
 }
 
@@ -106,6 +207,8 @@ xfont_create(Drw *drw, const char *fontname, FcPattern *fontpattern)
 	Fnt *font;
 	XftFont *xfont = NULL;
 	FcPattern *pattern = NULL;
+	FcPattern *match;
+	XftResult result;
 
 	if (fontname) {
 		/* Using the pattern found at font->xfont->pattern does not yield the
@@ -113,13 +216,22 @@ xfont_create(Drw *drw, const char *fontname, FcPattern *fontpattern)
 		 * FcNameParse; using the latter results in the desired fallback
 		 * behaviour whereas the former just results in missing-character
 		 * rectangles being drawn, at least with some fonts. */
-		if (!(xfont = XftFontOpenName(drw->dpy, drw->screen, fontname))) {
-			fprintf(stderr, "error, cannot load font from name: '%s'\n", fontname);
-			return NULL;
-		}
 		if (!(pattern = FcNameParse((FcChar8 *) fontname))) {
 			fprintf(stderr, "error, cannot parse font name to pattern: '%s'\n", fontname);
-			XftFontClose(drw->dpy, xfont);
+			return NULL;
+		}
+		/* This is what XftFontOpenName does, except that the match comes
+		 * from the disk cache when an earlier run already made it. */
+		if ((match = fontdisk_font(fontname)) && !(xfont = XftFontOpenPattern(drw->dpy, match)))
+			FcPatternDestroy(match);
+		if (!xfont && (match = XftFontMatch(drw->dpy, drw->screen, pattern, &result))) {
+			fontdisk_store_font(fontname, match);
+			if (!(xfont = XftFontOpenPattern(drw->dpy, match)))
+				FcPatternDestroy(match);
+		}
+		if (!xfont) {
+			fprintf(stderr, "error, cannot load font from name: '%s'\n", fontname);
+			FcPatternDestroy(pattern);
 			return NULL;
 		}
 	} else if (fontpattern) {
@@ -164,6 +276,180 @@ xfont_free(Fnt *font)
 	free(font);
 }
 
+#define ADVCACHE_AT(cache, i) (&(cache)->entries[(i) - 1])
+
+static void
+advcache_unlink(AdvanceCache *cache, unsigned int i)
+{
+	AdvanceEntry *e = ADVCACHE_AT(cache, i);
+
+	if (e->prev)
+		ADVCACHE_AT(cache, e->prev)->next = e->next;
+	else
+		cache->head = e->next;
+	if (e->next)
+		ADVCACHE_AT(cache, e->next)->prev = e->prev;
+	else
+		cache->tail = e->prev;
+}
+
+static void
+advcache_push_front(AdvanceCache *cache, unsigned int i)
+{
+	AdvanceEntry *e = ADVCACHE_AT(cache, i);
+
+	e->prev = 0;
+	e->next = cache->head;
+	if (cache->head)
+		ADVCACHE_AT(cache, cache->head)->prev = i;
+	cache->head = i;
+	if (!cache->tail)
+		cache->tail = i;
+}
+
+/* Advance of one word, measured by Xft only when it is not cached */
+static unsigned int
+word_advance(Drw *drw, Fnt *font, const char *text, size_t len)
+{
+	AdvanceCache *cache = &drw->advcache;
+	AdvanceEntry *e;
+	unsigned int i, *link, w = 0;
+	uint64_t hash;
+
+	if (len > ADVCACHE_KEY) {
+		drw_font_getexts(font, text, len, &w, NULL);
+		return w;
+	}
+
+	hash = hash_bytes(text, len) ^ ((uintptr_t)font * 0x9E3779B97F4A7C15ull);
+	for (i = cache->buckets[hash & (ADVCACHE_BUCKETS - 1)]; i; i = e->hnext) {
+		e = ADVCACHE_AT(cache, i);
+		if (e->hash == hash && e->font == font && e->len == len && !memcmp(e->bytes, text, len)) {
+			stats.advance_hits++;
+			advcache_unlink(cache, i);
+			advcache_push_front(cache, i);
+			return e->w;
+		}
+	}
+	stats.advance_misses++;
+	drw_font_getexts(font, text, len, &w, NULL);
+
+	if (cache->len < ADVCACHE_SIZE) {
+		i = ++cache->len;
+	} else {
+		/* reuse the least recently used entry */
+		i = cache->tail;
+		e = ADVCACHE_AT(cache, i);
+		for (link = &cache->buckets[e->hash & (ADVCACHE_BUCKETS - 1)]; *link != i; link = &ADVCACHE_AT(cache, *link)->hnext)
+			; /* NOP */
+		*link = e->hnext;
+		advcache_unlink(cache, i);
+	}
+
+	e = ADVCACHE_AT(cache, i);
+	e->font = font;
+	e->hash = hash;
+	e->w = w;
+	e->len = len;
+	memcpy(e->bytes, text, len);
+	e->hnext = cache->buckets[hash & (ADVCACHE_BUCKETS - 1)];
+	cache->buckets[hash & (ADVCACHE_BUCKETS - 1)] = i;
+	advcache_push_front(cache, i);
+	return w;
+}
+
+/* Stands for codepoints no font has a glyph for, they are drawn with the first font */
+static Fnt fontcache_missing;
+
+/* Find a system font with a glyph for the codepoint and append it to the set.
+ * Returns NULL if there is none. */
+static Fnt *
+xfont_fallback(Drw *drw, long codepoint)
+{
+	FcCharSet *fccharset;
+	FcPattern *fcpattern;
+	FcPattern *match;
+	XftResult result;
+	Fnt *font, *last;
+	FcChar8 *base;
+	int known;
+
+	if (!drw->fonts->pattern) {
+		/* Refer to the comment in xfont_create for more information. */
+		die("the first font in the cache must be loaded from a font string.");
+	}
+
+	/* earlier runs may have looked for this codepoint already */
+	base = FcNameUnparse(drw->fonts->pattern);
+	known = base && fontdisk_fallback((char *)base, codepoint, &match);
+	if (known && !match) {
+		free(base);
+		return NULL;
+	}
+	if (known) {
+		if ((font = xfont_create(drw, NULL, match)) && XftCharExists(drw->dpy, font->xfont, codepoint))
+			goto append;
+		/* the font went away or changed since, match again and replace the entry */
+		xfont_free(font);
+	}
+
+	fccharset = FcCharSetCreate();
+	FcCharSetAddChar(fccharset, codepoint);
+
+	fcpattern = FcPatternDuplicate(drw->fonts->pattern);
+	FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
+	FcPatternAddBool(fcpattern, FC_SCALABLE, FcTrue);
+	FcPatternAddBool(fcpattern, FC_COLOR, FcFalse);
+
+	FcConfigSubstitute(NULL, fcpattern, FcMatchPattern);
+	FcDefaultSubstitute(fcpattern);
+	match = XftFontMatch(drw->dpy, drw->screen, fcpattern, &result);
+
+	FcCharSetDestroy(fccharset);
+	FcPatternDestroy(fcpattern);
+
+	font = match ? xfont_create(drw, NULL, match) : NULL;
+	if (!font || !XftCharExists(drw->dpy, font->xfont, codepoint)) {
+		xfont_free(font);
+		font = NULL;
+	}
+	if (base)
+		fontdisk_store_fallback((char *)base, codepoint, font ? font->xfont->pattern : NULL);
+
+append:
+	free(base);
+	if (!font)
+		return NULL;
+	for (last = drw->fonts; last->next; last = last->next)
+		; /* NOP */
+	return (last->next = font);
+}
+
+/* The font to draw the codepoint with: the first of drw->fonts with a glyph
+ * for it, a fallback font found through fontconfig, or the first font if
+ * there is no glyph anywhere. Fallback fonts are only ever appended to the
+ * set, so every answer, the negative ones too, holds until the set is
+ * replaced and the expensive fontconfig search runs once per codepoint. */
+static Fnt *
+drw_font_for(Drw *drw, long codepoint)
+{
+	Fnt **slot, *font;
+
+	slot = fontcache_slot(&drw->fontcache, codepoint);
+	if (*slot)
+		return *slot == &fontcache_missing ? drw->fonts : *slot;
+
+	for (font = drw->fonts; font; font = font->next)
+		if (XftCharExists(drw->dpy, font->xfont, codepoint))
+			return (*slot = font);
+
+	if ((font = xfont_fallback(drw, codepoint)))
+		return (*slot = font);
+
+	*slot = &fontcache_missing;
+	return drw->fonts;
+}
+
 Fnt*
 drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 {
@@ -173,12 +459,16 @@ drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 	if (!drw || !fonts)
 		return NULL;
 
+	fontdisk_open(drw->dpy, drw->screen);
 	for (i = 1; i <= fontcount; i++) {
 		if ((cur = xfont_create(drw, fonts[fontcount - i], NULL))) {
 			cur->next = ret;
 			ret = cur;
 		}
 	}
+	fontcache_clear(&drw->fontcache);
+	memset(&drw->advcache, 0, sizeof(AdvanceCache));
+	shmimage_clear_glyphs(drw->shm);
 	return (drw->fonts = ret);
 }
 
@@ -220,11 +510,79 @@ drw_scm_create(Drw *drw, const char *clrnames[], size_t clrcount)
 	return ret;
 }
 
+/* Named colors are a round trip to the server, #rgb and #rrggbb are not on
+ * TrueColor visuals, as they are turned into values here. */
+static int
+clr_alloc(Drw *drw, Clr *dest, const char *clrname)
+{
+	XRenderColor value;
+	unsigned int r, g, b;
+	size_t len = strlen(clrname);
+	int n;
+
+	if (clrname[0] == '#' && (len == 4 || len == 7) && strspn(clrname + 1, "0123456789abcdefABCDEF") == len - 1) {
+		if (len == 4) {
+			n = sscanf(clrname + 1, "%1x%1x%1x", &r, &g, &b);
+			r *= 0x11, g *= 0x11, b *= 0x11;
+		} else {
+			n = sscanf(clrname + 1, "%2x%2x%2x", &r, &g, &b);
+		}
+		if (n != 3)
+			return 0;
+		value.red = r * 0x101;
+		value.green = g * 0x101;
+		value.blue = b * 0x101;
+		value.alpha = 0xFFFF;
+		return XftColorAllocValue(drw->dpy, DefaultVisual(drw->dpy, drw->screen),
+		                          DefaultColormap(drw->dpy, drw->screen), &value, dest);
+	}
+	return XftColorAllocName(drw->dpy, DefaultVisual(drw->dpy, drw->screen),
+	                         DefaultColormap(drw->dpy, drw->screen), clrname, dest);
+}
+
+/* The color for a name, allocated the first time it is asked for. Returns
+ * NULL for names that can not be allocated. Laid out text keeps pointers to
+ * the colors, so none is evicted; past CLRCACHE_MAX names the table stops
+ * growing and new ones get NULL too. */
+Clr *
+drw_clr_get(Drw *drw, const char *clrname, size_t len)
+{
+	ClrEntry **bucket, *e;
+
+	if (!drw)
+		return NULL;
+
+	bucket = &drw->colors[hash_bytes(clrname, len) & (CLRCACHE_BUCKETS - 1)];
+	for (e = *bucket; e; e = e->next)
+		if (strlen(e->name) == len && !memcmp(e->name, clrname, len))
+			return e->ok ? &e->color : NULL;
+
+	if (drw->colors_len >= CLRCACHE_MAX) {
+		if (drw->colors_len++ == CLRCACHE_MAX)
+			fprintf(stderr, "error, more than %d markup colors, the others are not allocated\n", CLRCACHE_MAX);
+		return NULL;
+	}
+	drw->colors_len++;
+	e = ecalloc(1, sizeof(ClrEntry));
+	e->name = ecalloc(len + 1, 1);
+	memcpy(e->name, clrname, len);
+	if (!(e->ok = clr_alloc(drw, &e->color, e->name)))
+		fprintf(stderr, "error, cannot allocate color '%s'\n", e->name);
+	e->next = *bucket;
+	*bucket = e;
+	return e->ok ? &e->color : NULL;
+}
+
 void
 drw_setfontset(Drw *drw, Fnt *set)
 {
-	if (drw)
+	if (drw && drw->fonts != set) {
+		fontcache_clear(&drw->fontcache);
+		memset(&drw->advcache, 0, sizeof(AdvanceCache));
+		/* glyphs are cached by font pointer, a freed font's may be reused */
+		shmimage_clear_glyphs(drw->shm);
 		drw->fonts = set;
+	}
 }
 
 void
@@ -234,157 +592,492 @@ drw_set_scheme(Drw *drw, Clr *scm)
 		drw->scheme = scm;
 }
 
+static void
+fill(Drw *drw, int x, int y, unsigned int w, unsigned int h, Clr *color)
+{
+	if (drw->shm) {
+		shmimage_fill(drw->shm, x, y, w, h, color);
+		return;
+	}
+	XSetForeground(drw->dpy, drw->gc, color->pixel);
+	XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
+}
+
+static void
+draw_glyphs(Drw *drw, Clr *color, const XftGlyphFontSpec *specs, size_t len)
+{
+	if (drw->shm)
+		shmimage_glyphs(drw->shm, color, specs, len);
+	else
+		XftDrawGlyphFontSpec(drw->xftdraw, color, specs, len);
+}
+
 void
 drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int invert)
 {
+	Clr *color;
+
 	if (!drw || !drw->scheme)
 		return;
-	XSetForeground(drw->dpy, drw->gc, drw->scheme[invert ? ColBg : ColFg].pixel);
-	if (filled)
-		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
-	else
+	color = &drw->scheme[invert ? ColBg : ColFg];
+
+	if (filled) {
+		fill(drw, x, y, w, h, color);
+	} else if (drw->shm) {
+		fill(drw, x, y, w, 1, color);
+		fill(drw, x, y + h - 1, w, 1, color);
+		fill(drw, x, y, 1, h, color);
+		fill(drw, x + w - 1, y, 1, h, color);
+	} else {
+		XSetForeground(drw->dpy, drw->gc, color->pixel);
 		XDrawRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w - 1, h - 1);
+	}
 }
 
 int
 drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, int invert)
 {
-	char buf[1024];
-	int ty;
-	unsigned int ew;
-	XftDraw *d = NULL;
-	Fnt *usedfont, *curfont, *nextfont;
-	size_t i, len;
-	int utf8strlen, utf8charlen, render = x || y || w || h;
-	long utf8codepoint = 0;
-	const char *utf8str;
-	FcCharSet *fccharset;
-	FcPattern *fcpattern;
-	FcPattern *match;
-	XftResult result;
-	int charexists = 0;
+	if (!text)
+		return 0;
+	return drw_text_n(drw, x, y, w, h, lpad, text, strlen(text), invert);
+}
+
+int
+drw_text_n(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, size_t textlen, int invert)
+{
+	int render = x || y || w || h;
 
 	if (!drw || (render && !drw->scheme) || !text || !drw->fonts)
 		return 0;
 
-	if (!render) {
-		w = ~w;
-	} else {
-		XSetForeground(drw->dpy, drw->gc, drw->scheme[invert ? ColFg : ColBg].pixel);
-		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
-		d = XftDrawCreate(drw->dpy, drw->drawable,
-		                  DefaultVisual(drw->dpy, drw->screen),
-		                  DefaultColormap(drw->dpy, drw->screen));
-		x += lpad;
-		w -= lpad;
-	}
-
-	usedfont = drw->fonts;
-	while (1) {
-		utf8strlen = 0;
-		utf8str = text;
-		nextfont = NULL;
-		while (*text) {
-			utf8charlen = utf8decode(text, &utf8codepoint);
-			for (curfont = drw->fonts; curfont; curfont = curfont->next) {
-				charexists = charexists || XftCharExists(drw->dpy, curfont->xfont, utf8codepoint);
-				if (charexists) {
-					if (curfont == usedfont) {
-						utf8strlen += utf8charlen;
-						text += utf8charlen;
-					} else {
-						nextfont = curfont;
-					}
-					break;
-				}
-			}
+	drw_layout(drw, text, textlen, render ? w - lpad : ~0u, 0, &drw->scratch);
+	if (!render)
+		return drw->scratch.w;
 
-			if (!charexists || nextfont)
-				break;
+	if (lpad)
+		fill(drw, x, y, lpad, h, &drw->scheme[invert ? ColFg : ColBg]);
+	drw_text_layout(drw, x + lpad, y, w - lpad, h, text, &drw->scratch, 0, textlen, invert);
+	return x + w;
+}
+
+/* Add the bytes word..end, all in the font of the last run: their advance,
+ * and their glyphs with the pen positions drawing places them at */
+static void
+layout_word(Drw *drw, TextLayout *layout, const char *text, size_t word, size_t end)
+{
+	TextRun *run = &layout->runs[layout->len - 1];
+	unsigned int w = word_advance(drw, run->font, text + word, end - word);
+	unsigned int pen = run->w;
+	XGlyphInfo ext;
+	LayoutGlyph *g;
+	size_t i, charlen;
+	long codepoint;
+
+	/* there are never more glyphs than bytes */
+	if (layout->glyphs_len + (end - word) > layout->glyphs_size) {
+		layout->glyphs_size = MAX(layout->glyphs_size * 2, layout->glyphs_len + (end - word));
+		if (!(layout->glyphs = realloc(layout->glyphs, layout->glyphs_size * sizeof(LayoutGlyph))))
+			die("realloc:");
+	}
+	for (i = word; i < end; i += charlen) {
+		if (layout->ascii) {
+			codepoint = text[i];
+			charlen = 1;
+		} else {
+			charlen = utf8decode(text + i, &codepoint);
+		}
+		g = &layout->glyphs[layout->glyphs_len++];
+		g->offset = i;
+		g->index = XftCharIndex(drw->dpy, run->font->xfont, codepoint);
+		g->x = pen;
+		XftGlyphExtents(drw->dpy, run->font->xfont, &g->index, 1, &ext);
+		pen += ext.xOff;
+	}
+	run->glyphs_len = layout->glyphs_len - run->glyph;
+
+	run->len = end - run->offset;
+	run->w += w;
+	layout->w += w;
+
+	if (layout->steps_len == layout->steps_size) {
+		layout->steps_size = layout->steps_size ? layout->steps_size * 2 : 16;
+		if (!(layout->steps = realloc(layout->steps, layout->steps_size * sizeof(LayoutStep))))
+			die("realloc:");
+	}
+	layout->steps[layout->steps_len].end = end;
+	layout->steps[layout->steps_len++].w = layout->w;
+}
+
+/* Cut the layout so that it fits maxw together with an ellipsis. The cut is
+ * found by binary search, first over the word steps, then over the
+ * codepoint boundaries inside the word it falls into. */
+static void
+layout_truncate(Drw *drw, TextLayout *layout, const char *text, unsigned int maxw)
+{
+	static const char ellipsis[] = "\xe2\x80\xa6"; /* U+2026 */
+	size_t lo, hi, mid, cut, start, end, bounds[ADVCACHE_KEY + 1], nbounds, i;
+	unsigned int avail, cutw, w = 0;
+	long codepoint;
+	TextRun *run;
+
+	layout->ellipsis = drw_font_for(drw, 0x2026);
+	layout->ellipsis_glyph = XftCharIndex(drw->dpy, layout->ellipsis->xfont, 0x2026);
+	layout->ellipsis_w = word_advance(drw, layout->ellipsis, ellipsis, sizeof(ellipsis) - 1);
+	avail = maxw > layout->ellipsis_w ? maxw - layout->ellipsis_w : 0;
+
+	/* the last step that still fits */
+	for (lo = 0, hi = layout->steps_len; lo < hi; ) {
+		mid = (lo + hi) / 2;
+		if (layout->steps[mid].w <= avail)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	cut = lo ? layout->steps[lo - 1].end : 0;
+	cutw = lo ? layout->steps[lo - 1].w : 0;
+
+	/* the next word was too wide, keep as many of its characters as fit */
+	if (lo < layout->steps_len) {
+		end = layout->steps[lo].end;
+		for (run = &layout->runs[layout->len - 1]; run->offset >= end; run--)
+			; /* NOP */
+		/* markup between the steps is not part of the word */
+		start = MAX(cut, run->offset);
+		for (nbounds = 0, i = start; i < end; i += utf8decode(text + i, &codepoint))
+			bounds[nbounds++] = i;
+		for (lo = 0, hi = nbounds; lo + 1 < hi; ) {
+			mid = (lo + hi) / 2;
+			drw_font_getexts(run->font, text + start, bounds[mid] - start, &w, NULL);
+			if (cutw + w <= avail)
+				lo = mid;
 			else
-				charexists = 0;
+				hi = mid;
+		}
+		if (bounds[lo] > start) {
+			drw_font_getexts(run->font, text + start, bounds[lo] - start, &w, NULL);
+			cutw += w;
+			cut = bounds[lo];
 		}
+	}
+
+	/* drop what is past the cut, the last run keeps the rest of the advance */
+	while (layout->len && layout->runs[layout->len - 1].offset >= cut && cut > 0)
+		layout->len--;
+	if (!cut)
+		layout->len = 0;
+	for (i = 0, w = 0; i + 1 < layout->len; i++)
+		w += layout->runs[i].w;
+	if (layout->len) {
+		run = &layout->runs[layout->len - 1];
+		run->len = cut - run->offset;
+		run->w = cutw - w;
+		for (i = run->glyph; i < run->glyph + run->glyphs_len && layout->glyphs[i].offset < cut; i++)
+			; /* NOP */
+		run->glyphs_len = i - run->glyph;
+		layout->glyphs_len = i;
+	} else {
+		layout->glyphs_len = 0;
+	}
+
+	layout->end = cut;
+	layout->w = cutw + layout->ellipsis_w;
+	layout->h = layout->ellipsis->h;
+	for (i = 0; i < layout->len; i++)
+		layout->h = MAX(layout->h, layout->runs[i].font->h);
+}
+
+/* The style markup switches to */
+typedef struct {
+	Clr *fg, *bg;
+	Fnt *font; /* tried before the font set, NULL for none */
+} Style;
+
+/* Parse a markup tag at text, updating style. Returns its length, 1 for the
+ * ^^ escape, or 0 if text does not start a tag and is drawn as it is. */
+static size_t
+markup_parse(Drw *drw, const char *text, size_t len, Style *style)
+{
+	const char *arg, *close;
+	Fnt *font;
+	long index;
+
+	if (len >= 2 && text[1] == '^')
+		return 1;
+	if (len < 5 || text[3] != '(' || !(close = memchr(text + 4, ')', len - 4)))
+		return 0;
+	arg = text + 4;
+
+	if (!strncmp(text + 1, "fg", 2)) {
+		style->fg = close > arg ? drw_clr_get(drw, arg, close - arg) : NULL;
+	} else if (!strncmp(text + 1, "bg", 2)) {
+		style->bg = close > arg ? drw_clr_get(drw, arg, close - arg) : NULL;
+	} else if (!strncmp(text + 1, "fn", 2)) {
+		/* an index into the configured fonts, fallback ones follow them */
+		index = close > arg ? strtol(arg, NULL, 10) : 0;
+		for (font = drw->fonts; font && index > 0; font = font->next, index--)
+			; /* NOP */
+		style->font = close > arg && font != drw->fonts ? font : NULL;
+	} else {
+		return 0;
+	}
+	return close - text + 1;
+}
+
+/* Split text into runs of one font and style and measure them a word at a
+ * time. Layout stops as soon as the text gets wider than maxw, the rest is
+ * replaced by an ellipsis, so very long lines cost about as much as ones that
+ * fit. Text known to be ASCII skips UTF-8 decoding. */
+void
+drw_layout(Drw *drw, const char *text, size_t textlen, unsigned int maxw, int flags, TextLayout *layout)
+{
+	Fnt *font, *usedfont = NULL;
+	TextRun *run;
+	Style style = {0};
+	size_t i, word = 0, charlen, taglen;
+	long codepoint;
+	int escaped = 0;
+
+	layout->len = layout->steps_len = layout->glyphs_len = 0;
+	layout->w = layout->h = 0;
+	layout->end = textlen;
+	layout->ellipsis = NULL;
+	layout->ellipsis_w = 0;
+	layout->ascii = flags & LayoutAscii;
+	layout->styled = 0;
+	if (!drw || !text || !drw->fonts)
+		return;
 
-		if (utf8strlen) {
-			drw_font_getexts(usedfont, utf8str, utf8strlen, &ew, NULL);
-			/* shorten text if necessary */
-			for (len = MIN(utf8strlen, sizeof(buf) - 1); len && ew > w; len--)
-				drw_font_getexts(usedfont, utf8str, len, &ew, NULL);
-
-			if (len) {
-				memcpy(buf, utf8str, len);
-				buf[len] = '\0';
-				if (len < utf8strlen)
-					for (i = len; i && i > len - 3; buf[--i] = '.')
-						; /* NOP */
-
-				if (render) {
-					ty = y + (h - usedfont->h) / 2 + usedfont->xfont->ascent;
-					XftDrawStringUtf8(d, &drw->scheme[invert ? ColBg : ColFg],
-					                  usedfont->xfont, x, ty, (XftChar8 *)buf, len);
-				}
-				x += ew;
-				w -= ew;
+	for (i = 0; i < textlen; i += charlen) {
+		if ((flags & LayoutMarkup) && text[i] == '^' && !escaped
+		    && (taglen = markup_parse(drw, text + i, textlen - i, &style))) {
+			/* tags are not drawn, the text after one starts a run of its own */
+			if (i > word) {
+				layout_word(drw, layout, text, word, i);
+				if (layout->w > maxw)
+					break;
 			}
+			word = i + taglen;
+			usedfont = NULL;
+			escaped = taglen == 1;
+			charlen = taglen;
+			continue;
 		}
+		escaped = 0;
 
-		if (!*text) {
-			break;
-		} else if (nextfont) {
-			charexists = 0;
-			usedfont = nextfont;
+		if (layout->ascii) {
+			codepoint = text[i];
+			charlen = 1;
 		} else {
-			/* Regardless of whether or not a fallback font is found, the
-			 * character must be drawn. */
-			charexists = 1;
+			charlen = utf8decode(text + i, &codepoint);
+		}
+		if (style.font && XftCharExists(drw->dpy, style.font->xfont, codepoint))
+			font = style.font;
+		else
+			font = drw_font_for(drw, codepoint);
+
+		/* words end after their spaces, and are kept short enough to be cached */
+		if (
+			font == usedfont && i + charlen - word <= ADVCACHE_KEY
+			&& !(text[i] != ' ' && text[i - 1] == ' ')
+		)
+			continue;
+
+		if (i > word) {
+			layout_word(drw, layout, text, word, i);
+			if (layout->w > maxw)
+				break;
+		}
+		word = i;
+		if (font == usedfont)
+			continue;
+
+		if (layout->len == layout->size) {
+			layout->size = layout->size ? layout->size * 2 : 8;
+			if (!(layout->runs = realloc(layout->runs, layout->size * sizeof(TextRun))))
+				die("realloc:");
+		}
+		run = &layout->runs[layout->len++];
+		run->font = usedfont = font;
+		run->fg = style.fg;
+		run->bg = style.bg;
+		layout->styled |= style.fg || style.bg || style.font;
+		run->offset = i;
+		run->len = 0;
+		run->w = 0;
+		run->glyph = layout->glyphs_len;
+		run->glyphs_len = 0;
+		layout->h = MAX(layout->h, font->h);
+	}
+	if (i >= textlen && textlen > word && layout->len)
+		layout_word(drw, layout, text, word, textlen);
 
-			fccharset = FcCharSetCreate();
-			FcCharSetAddChar(fccharset, utf8codepoint);
+	if (layout->w > maxw)
+		layout_truncate(drw, layout, text, maxw);
+}
 
-			if (!drw->fonts->pattern) {
-				/* Refer to the comment in xfont_create for more information. */
-				die("the first font in the cache must be loaded from a font string.");
-			}
+void
+drw_layout_free(TextLayout *layout)
+{
+	free(layout->runs);
+	free(layout->steps);
+	free(layout->glyphs);
+	layout->runs = NULL;
+	layout->steps = NULL;
+	layout->glyphs = NULL;
+	layout->len = layout->size = 0;
+	layout->steps_len = layout->steps_size = 0;
+	layout->glyphs_len = layout->glyphs_size = 0;
+}
+
+/* The first glyph of the run at or after the byte offset, the run's glyph
+ * count past its end */
+static size_t
+run_glyph_at(const TextLayout *layout, const TextRun *run, size_t offset)
+{
+	size_t lo = 0, hi = run->glyphs_len, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (layout->glyphs[run->glyph + mid].offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Pen position of a glyph of the run, the run's advance past its end */
+static unsigned int
+run_pen(const TextLayout *layout, const TextRun *run, size_t glyph)
+{
+	return glyph < run->glyphs_len ? layout->glyphs[run->glyph + glyph].x : run->w;
+}
+
+/* Clip the run to the bytes start..end of the text, returning the width of
+ * what is left and its glyphs. Both ends must be on codepoint boundaries. */
+static unsigned int
+run_clip(const TextLayout *layout, const TextRun *run, size_t start, size_t end, size_t *first, size_t *last)
+{
+	start = MAX(start, run->offset);
+	end = MIN(end, run->offset + run->len);
+	*first = *last = 0;
+	if (start >= end)
+		return 0;
+	if (start == run->offset && end == run->offset + run->len) {
+		*last = run->glyphs_len;
+		return run->w;
+	}
+	*first = run_glyph_at(layout, run, start);
+	*last = run_glyph_at(layout, run, end);
+	return run_pen(layout, run, *last) - run_pen(layout, run, *first);
+}
+
+unsigned int
+drw_layout_width(const TextLayout *layout, size_t start, size_t end)
+{
+	unsigned int w = 0;
+	size_t i, first, last;
+
+	for (i = 0; i < layout->len; i++)
+		w += run_clip(layout, &layout->runs[i], start, end, &first, &last);
+	if (layout->ellipsis && start <= layout->end && end >= layout->end)
+		w += layout->ellipsis_w;
+	return w;
+}
+
+/* Draw the bytes start..end of a laid out text at x, filling the box with
+ * the background first. The glyphs were resolved by the layout, they are
+ * only placed at the origin and go to the server in a single
+ * XftDrawGlyphFontSpec call, or one per change of color for markup. Returns
+ * the x where the text ends. */
+int
+drw_text_layout(Drw *drw, int x, int y, unsigned int w, unsigned int h, const char *text, const TextLayout *layout, size_t start, size_t end, int invert)
+{
+	const TextRun *run;
+	const LayoutGlyph *g;
+	Clr *fg, *runfg;
+	unsigned int ew;
+	size_t i, j, first, last, n = 0;
+	int ty, origin;
+
+	if (!drw || !drw->scheme || !text)
+		return x;
+
+	fill(drw, x, y, w, h, &drw->scheme[invert ? ColFg : ColBg]);
+	fg = &drw->scheme[invert ? ColBg : ColFg];
 
-			fcpattern = FcPatternDuplicate(drw->fonts->pattern);
-			FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
-			FcPatternAddBool(fcpattern, FC_SCALABLE, FcTrue);
-			FcPatternAddBool(fcpattern, FC_COLOR, FcFalse);
-
-			FcConfigSubstitute(NULL, fcpattern, FcMatchPattern);
-			FcDefaultSubstitute(fcpattern);
-			match = XftFontMatch(drw->dpy, drw->screen, fcpattern, &result);
-
-			FcCharSetDestroy(fccharset);
-			FcPatternDestroy(fcpattern);
-
-			if (match) {
-				usedfont = xfont_create(drw, NULL, match);
-				if (usedfont && XftCharExists(drw->dpy, usedfont->xfont, utf8codepoint)) {
-					for (curfont = drw->fonts; curfont->next; curfont = curfont->next)
-						; /* NOP */
-					curfont->next = usedfont;
-				} else {
-					xfont_free(usedfont);
-					usedfont = drw->fonts;
-				}
+	/* there are never more glyphs than bytes, plus the ellipsis */
+	if (drw->specs_size < end - start + 1) {
+		drw->specs_size = end - start + 1;
+		if (!(drw->specs = realloc(drw->specs, drw->specs_size * sizeof(XftGlyphFontSpec))))
+			die("realloc:");
+	}
+
+	for (i = 0; i < layout->len; i++) {
+		run = &layout->runs[i];
+		ew = run_clip(layout, run, start, end, &first, &last);
+		if (!ew && first == last)
+			continue;
+
+		if (layout->styled) {
+			runfg = run->fg ? run->fg : &drw->scheme[invert ? ColBg : ColFg];
+			if (runfg != fg && n) {
+				draw_glyphs(drw, fg, drw->specs, n);
+				n = 0;
 			}
+			fg = runfg;
+			if (run->bg)
+				fill(drw, x, y, ew, h, run->bg);
+		}
+
+		/* runs start where the layout measured them, glyphs inside at their pen positions */
+		ty = y + (h - run->font->h) / 2 + run->font->xfont->ascent;
+		origin = x - (int)run_pen(layout, run, first);
+		for (j = first; j < last; j++) {
+			g = &layout->glyphs[run->glyph + j];
+			drw->specs[n].font = run->font->xfont;
+			drw->specs[n].glyph = g->index;
+			drw->specs[n].x = origin + g->x;
+			drw->specs[n].y = ty;
+			n++;
 		}
+		x += ew;
 	}
-	if (d)
-		XftDrawDestroy(d);
 
-	return x + (render ? w : 0);
+	if (layout->ellipsis && start <= layout->end && end >= layout->end) {
+		if (n && fg != &drw->scheme[invert ? ColBg : ColFg]) {
+			draw_glyphs(drw, fg, drw->specs, n);
+			n = 0;
+		}
+		fg = &drw->scheme[invert ? ColBg : ColFg];
+		drw->specs[n].font = layout->ellipsis->xfont;
+		drw->specs[n].glyph = layout->ellipsis_glyph;
+		drw->specs[n].x = x;
+		drw->specs[n].y = y + (h - layout->ellipsis->h) / 2 + layout->ellipsis->xfont->ascent;
+		n++;
+		x += layout->ellipsis_w;
+	}
+
+	if (n)
+		draw_glyphs(drw, fg, drw->specs, n);
+
+	return x;
 }
 
+/* Only queues the copy, the caller flushes once the whole frame is out, so
+ * drawing never waits for a round trip to the server. With a shared image
+ * the next drawing goes to its other buffer instead, and only waits when the
+ * server still reads that one too. */
 void
 drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h)
 {
 	if (!drw)
 		return;
 
-	XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, x, y);
-	XSync(drw->dpy, False);
+	if (drw->shm)
+		shmimage_put(drw->shm, win, drw->gc, x, y, w, h);
+	else
+		XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, x, y);
 }
 
 unsigned int
@@ -437,93 +1130,17 @@ drw_cur_free(Drw *drw, Cur *cursor)
 void
 get_text_rect(Drw *drw, const char *text, Rect * rect)
 {
-	unsigned int ew;
-	Fnt *usedfont, *curfont, *nextfont;
-	int utf8strlen, utf8charlen;
-	long utf8codepoint = 0;
-	const char *utf8str;
-	FcCharSet *fccharset;
-	FcPattern *fcpattern;
-	FcPattern *match;
-	XftResult result;
-	int charexists = 0;
+	if (text)
+		get_text_rect_n(drw, text, strlen(text), rect);
+}
 
+void
+get_text_rect_n(Drw *drw, const char *text, size_t textlen, Rect * rect)
+{
 	if (!drw || !text || !drw->fonts)
 		return;
 
-	usedfont = drw->fonts;
-	while (1) {
-		utf8strlen = 0;
-		utf8str = text;
-		nextfont = NULL;
-		while (*text) {
-			utf8charlen = utf8decode(text, &utf8codepoint);
-			for (curfont = drw->fonts; curfont; curfont = curfont->next) {
-				charexists = charexists || XftCharExists(drw->dpy, curfont->xfont, utf8codepoint);
-				if (charexists) {
-					if (curfont == usedfont) {
-						utf8strlen += utf8charlen;
-						text += utf8charlen;
-					} else {
-						nextfont = curfont;
-					}
-					break;
-				}
-			}
-
-			if (!charexists || nextfont)
-				break;
-			else
-				charexists = 0;
-		}
-
-		if (utf8strlen) {
-			drw_font_getexts(usedfont, utf8str, utf8strlen, &ew, NULL);
-			rect->w += ew;
-			rect->h = MAX(rect->h, usedfont->h);
-		}
-
-		if (!*text) {
-			break;
-		} else if (nextfont) {
-			charexists = 0;
-			usedfont = nextfont;
-		} else {
-			/* Regardless of whether or not a fallback font is found, the
-			 * character must be drawn. */
-			charexists = 1;
-
-			fccharset = FcCharSetCreate();
-			FcCharSetAddChar(fccharset, utf8codepoint);
-
-			if (!drw->fonts->pattern) {
-				/* Refer to the comment in xfont_create for more information. */
-				die("the first font in the cache must be loaded from a font string.");
-			}
-
-			fcpattern = FcPatternDuplicate(drw->fonts->pattern);
-			FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
-			FcPatternAddBool(fcpattern, FC_SCALABLE, FcTrue);
-			FcPatternAddBool(fcpattern, FC_COLOR, FcFalse);
-
-			FcConfigSubstitute(NULL, fcpattern, FcMatchPattern);
-			FcDefaultSubstitute(fcpattern);
-			match = XftFontMatch(drw->dpy, drw->screen, fcpattern, &result);
-
-			FcCharSetDestroy(fccharset);
-			FcPatternDestroy(fcpattern);
-
-			if (match) {
-				usedfont = xfont_create(drw, NULL, match);
-				if (usedfont && XftCharExists(drw->dpy, usedfont->xfont, utf8codepoint)) {
-					for (curfont = drw->fonts; curfont->next; curfont = curfont->next)
-						; /* NOP */
-					curfont->next = usedfont;
-				} else {
-					xfont_free(usedfont);
-					usedfont = drw->fonts;
-				}
-			}
-		}
-	}
+	drw_layout(drw, text, textlen, ~0u, 0, &drw->scratch);
+	rect->w += drw->scratch.w;
+	rect->h = MAX(rect->h, drw->scratch.h);
 }
@@ -1,6 +1,7 @@
 /* See LICENSE file for copyright and license details. */
 
 #include "geometry.h"
+#include "shmimage.h"
 
 typedef struct Cur {
 	Cursor cursor;
@@ -17,21 +18,131 @@ typedef struct Fnt {
 enum { ColFg, ColBg }; /* Clr scheme index */
 typedef XftColor Clr;
 
+#define CLRCACHE_BUCKETS 64
+#define CLRCACHE_MAX     1024 /* colors kept, later names draw in the scheme's */
+
+/* A color allocated once by name and kept for the Drw's lifetime */
+typedef struct ClrEntry {
+	char *name;
+	int ok; /* 0 if the name could not be allocated, so it is not retried */
+	Clr color;
+	struct ClrEntry *next;
+} ClrEntry;
+
+#define FONTCACHE_PAGE_BITS 8
+#define FONTCACHE_PAGES     (0x10000 >> FONTCACHE_PAGE_BITS)
+
+typedef struct {
+	unsigned int codepoint; /* 0 marks an empty slot, it is never astral */
+	Fnt *font;
+} FontCacheEntry;
+
+/* Which font of a set is the first with a glyph for a codepoint. The BMP is
+ * a direct-mapped table split into pages allocated on first use, the rest of
+ * Unicode goes into an open addressing hash. NULL means not looked up yet,
+ * codepoints without a glyph in any font get a marker of their own.
+ * Cleared whenever the Drw gets another font set. */
+typedef struct {
+	Fnt **bmp[FONTCACHE_PAGES];
+	FontCacheEntry *astral;
+	size_t astral_size; /* a power of two */
+	size_t astral_len;
+} FontCache;
+
+#define ADVCACHE_SIZE    512  /* entries, the least recently used one is evicted */
+#define ADVCACHE_BUCKETS 1024 /* a power of two */
+#define ADVCACHE_KEY     24   /* longer words are measured every time */
+
+/* Indices are stored plus one, so a zeroed cache is empty */
+typedef struct {
+	Fnt *font;
+	uint64_t hash;
+	unsigned int w;
+	unsigned int len;
+	char bytes[ADVCACHE_KEY];
+	unsigned int hnext; /* next entry in the same bucket */
+	unsigned int prev, next; /* recency list, most recent first */
+} AdvanceEntry;
+
+/* Advances of the words text is made of, keyed by font and bytes. Xft does
+ * not kern, so the advance of a run is the sum of the advances of its words. */
+typedef struct {
+	AdvanceEntry entries[ADVCACHE_SIZE];
+	unsigned int buckets[ADVCACHE_BUCKETS];
+	unsigned int len, head, tail;
+} AdvanceCache;
+
+/* A stretch of text drawn with one font and color */
+typedef struct {
+	Fnt *font;
+	Clr *fg, *bg; /* NULL for the scheme's colors */
+	size_t offset, len; /* bytes of the laid out text */
+	unsigned int w; /* advance */
+	size_t glyph, glyphs_len; /* its glyphs in the layout's */
+} TextRun;
+
+/* A glyph of a run, resolved once so drawing only positions it */
+typedef struct {
+	size_t offset; /* of its codepoint in the text */
+	FT_UInt index;
+	unsigned int x; /* pen position from the start of the run */
+} LayoutGlyph;
+
+/* Advance of the text up to a word boundary */
+typedef struct {
+	size_t end;
+	unsigned int w;
+} LayoutStep;
+
+/* Text split into runs once, then used both to measure and to draw it */
+typedef struct {
+	TextRun *runs;
+	size_t len, size;
+	LayoutStep *steps; /* ascending, searched for the cut when truncating */
+	size_t steps_len, steps_size;
+	LayoutGlyph *glyphs; /* of all runs in order */
+	size_t glyphs_len, glyphs_size;
+	unsigned int w, h;
+	size_t end; /* bytes laid out, less than the text length when truncated */
+	Fnt *ellipsis; /* set when truncated, drawn after the last run */
+	FT_UInt ellipsis_glyph;
+	unsigned int ellipsis_w;
+	int ascii; /* every byte is a character, nothing needs decoding */
+	int styled; /* some run has its own colors or font, from markup */
+} TextLayout;
+
 typedef struct {
 	unsigned int w, h;
 	Display *dpy;
 	int screen;
 	Window root;
 	Drawable drawable;
+	XftDraw *xftdraw; /* draws into drawable for as long as it lives */
 	GC gc;
 	Clr *scheme;
 	Fnt *fonts;
+	FontCache fontcache;
+	AdvanceCache advcache;
+	XftGlyphFontSpec *specs; /* reused by drw_text_layout */
+	size_t specs_size;
+	TextLayout scratch; /* for drw_text and get_text_rect */
+	ClrEntry *colors[CLRCACHE_BUCKETS]; /* markup colors by name */
+	size_t colors_len;
+	ShmImage *shm; /* drawn into instead of drawable when set, see drw_shm_enable */
 } Drw;
 
+/* drw_layout flags */
+enum {
+	LayoutAscii = 1, /* the text is pure ASCII, nothing needs decoding */
+	LayoutMarkup = 2, /* ^fg(color), ^bg(color) and ^fn(index) switch styles, ^^ is a caret */
+};
+
 /* Drawable abstraction */
 Drw *drw_create(Display *dpy, int screen, Window win, unsigned int w, unsigned int h);
 void drw_resize(Drw *drw, unsigned int w, unsigned int h);
 void drw_free(Drw *drw);
+int drw_shm_enable(Drw *drw);
+int drw_handle_event(Drw *drw, XEvent *ev);
 
 /* Fnt abstraction */
 Fnt *drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount);
@@ -42,6 +153,7 @@ void drw_font_getexts(Fnt *font, const char *text, unsigned int len, unsigned in
 /* Colorscheme abstraction */
 void drw_clr_create(Drw *drw, Clr *dest, const char *clrname);
 Clr *drw_scm_create(Drw *drw, const char *clrnames[], size_t clrcount);
+Clr *drw_clr_get(Drw *drw, const char *clrname, size_t len);
 
 /* Cursor abstraction */
 Cur *drw_cur_create(Drw *drw, int shape);
@@ -54,8 +166,16 @@ void drw_set_scheme(Drw *drw, Clr *scm);
 /* Drawing functions */
 void drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int invert);
 int drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, int invert);
+int drw_text_n(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, size_t textlen, int invert);
+
+/* Text layout */
+void drw_layout(Drw *drw, const char *text, size_t textlen, unsigned int maxw, int flags, TextLayout *layout);
+void drw_layout_free(TextLayout *layout);
+unsigned int drw_layout_width(const TextLayout *layout, size_t start, size_t end);
+int drw_text_layout(Drw *drw, int x, int y, unsigned int w, unsigned int h, const char *text, const TextLayout *layout, size_t start, size_t end, int invert);
 
 /* Map functions */
 void drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h);
 
 void get_text_rect(Drw *drw, const char *text, Rect * rect);
+void get_text_rect_n(Drw *drw, const char *text, size_t textlen, Rect * rect);
@@ -0,0 +1,110 @@
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+
+#include "follow.h"
+
+
+static bool lookup_failed;
+
+static int
+lookup_error(Display *dpy, XErrorEvent *ev)
+{
+    lookup_failed = true;
+    return 0;
+}
+
+/* The center of the active window in root coordinates. The window can be
+ * gone by the time it is asked about, so errors are caught instead of
+ * ending the program. */
+static bool
+active_window_center(Follow *follow, Display *dpy, int *x, int *y)
+{
+    Window root = DefaultRootWindow(dpy);
+    Window active = None, child, geometry_root;
+    Atom type;
+    int format, gx, gy;
+    unsigned long len, left;
+    unsigned char *data = NULL;
+    unsigned int w, h, border, depth;
+
+    if (
+        XGetWindowProperty(
+            dpy, root, follow->active_atom, 0, 1, False, XA_WINDOW,
+            &type, &format, &len, &left, &data
+        ) != Success
+    )
+        return false;
+    if (data && type == XA_WINDOW && format == 32 && len == 1)
+        active = *(Window *)data;
+    if (data)
+        XFree(data);
+    if (active == None)
+        return false;
+
+    lookup_failed = false;
+    XErrorHandler old = XSetErrorHandler(lookup_error);
+    bool ok = XGetGeometry(dpy, active, &geometry_root, &gx, &gy, &w, &h, &border, &depth)
+        && XTranslateCoordinates(dpy, active, root, w / 2, h / 2, x, y, &child);
+    XSync(dpy, False);
+    XSetErrorHandler(old);
+    return ok && !lookup_failed;
+}
+
+void
+follow_init(Follow *follow, Display *dpy, int screen, unsigned int interval_ms)
+{
+    Window root = RootWindow(dpy, screen);
+    XWindowAttributes attributes;
+
+    follow->active_atom = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", False);
+    follow->interval_ms = interval_ms;
+    follow->last = 0;
+    follow->monitor = -1;
+    /* look up where focus is right away */
+    follow->pending = true;
+
+    /* keep whatever else is selected on the root window */
+    XGetWindowAttributes(dpy, root, &attributes);
+    XSelectInput(dpy, root, attributes.your_event_mask | PropertyChangeMask);
+}
+
+bool
+follow_handle_event(Follow *follow, XEvent *ev)
+{
+    if (
+        ev->type != PropertyNotify || ev->xproperty.atom != follow->active_atom
+        || ev->xproperty.window != DefaultRootWindow(ev->xproperty.display)
+    )
+        return false;
+    follow->pending = true;
+    return true;
+}
+
+int
+follow_timeout(const Follow *follow, uint64_t now)
+{
+    uint64_t due = follow->last + follow->interval_ms;
+
+    if (!follow->pending)
+        return -1;
+    return now >= due ? 0 : due - now;
+}
+
+bool
+follow_update(Follow *follow, Display *dpy, const MonitorTable *table, uint64_t now)
+{
+    int x, y, monitor;
+
+    if (!follow->pending || now < follow->last + follow->interval_ms)
+        return false;
+    follow->pending = false;
+    follow->last = now;
+
+    if (!active_window_center(follow, dpy, &x, &y))
+        return false;
+    /* a window between monitors counts as still being on the old one */
+    if ((monitor = monitors_at(table, x, y)) < 0 || monitor == follow->monitor)
+        return false;
+    follow->monitor = monitor;
+    return true;
+}
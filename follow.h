@@ -0,0 +1,64 @@
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <X11/Xlib.h>
+
+#include "monitors.h"
+
+/*
+ * Tracks the monitor of the active window for panels that move along with
+ * it. Only _NET_ACTIVE_WINDOW changes on the root window wake it up, so
+ * nothing happens while focus stays put, and the active window is looked up
+ * at most once per interval however fast focus changes.
+ */
+
+typedef struct Follow {
+    Atom active_atom;
+    unsigned int interval_ms;
+    bool pending;  // focus changed since the last look up
+    uint64_t last;  // when the active window was last looked up
+    int monitor;  // the index in the monitor table of the active window, -1 if unknown
+} Follow;
+
+/**
+ * Start listening for focus changes
+ *
+ * @param follow The state to set up
+ * @param dpy The display
+ * @param screen The screen number
+ * @param interval_ms The shortest time between two look ups
+ */
+void follow_init(Follow *follow, Display *dpy, int screen, unsigned int interval_ms);
+
+/**
+ * Take a focus change
+ *
+ * @param follow The state
+ * @param ev An event from the queue
+ * @return true if the event was a change of the active window
+ */
+bool follow_handle_event(Follow *follow, XEvent *ev);
+
+/**
+ * The poll() timeout until a pending look up is due
+ *
+ * @param follow The state
+ * @param now monotonic_ms()
+ * @return The timeout, -1 if nothing is pending
+ */
+int follow_timeout(const Follow *follow, uint64_t now);
+
+/**
+ * Look up the active window's monitor if a focus change is due
+ *
+ * @param follow The state
+ * @param dpy The display
+ * @param table The monitors the window is checked against
+ * @param now monotonic_ms()
+ * @return true if the active window is on another monitor than before, see Follow.monitor
+ */
+bool follow_update(Follow *follow, Display *dpy, const MonitorTable *table, uint64_t now);
+
+#endif /* FOLLOW_H */
@@ -0,0 +1,297 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "fontdisk.h"
+#include "util.h"
+
+#define FONTDISK_MAGIC "light-status fonts 2"
+
+typedef struct FontDiskEntry {
+    char *key;  // "font\t<name>" or "fallback\t<base>\t<codepoint>"
+    char *pattern;  // unparsed match, empty if there was none
+} FontDiskEntry;
+
+static struct {
+    bool loaded;
+    uint64_t xft_stamp;  // see fontdisk_open
+    FILE *file;  // appended to as new fonts are resolved, NULL if the cache is unusable
+    FontDiskEntry *entries;
+    size_t len;
+    size_t size;
+    size_t *index;  // open addressing by key hash, entry index + 1, 0 for a free slot
+    size_t index_size;
+} disk;
+
+
+/* Newest modification time of everything that can change what fontconfig matches */
+static long
+fontconfig_stamp(void)
+{
+    FcConfig *config = FcConfigGetCurrent();
+    FcStrList *lists[] = {
+        FcConfigGetConfigFiles(config),
+        FcConfigGetFontDirs(config),
+        FcConfigGetCacheDirs(config),
+    };
+    struct stat st;
+    FcChar8 *path;
+    long stamp = 0;
+
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        if (!lists[i])
+            continue;
+        while ((path = FcStrListNext(lists[i])) != NULL)
+            if (stat((const char *)path, &st) == 0)
+                stamp = MAX(stamp, (long)st.st_mtime);
+        FcStrListDone(lists[i]);
+    }
+    return stamp;
+}
+
+/* The index slot of a key, holding its entry or free for it */
+static size_t *
+fontdisk_slot(const char *key)
+{
+    size_t mask = disk.index_size - 1;
+    size_t i = hash_bytes(key, strlen(key)) & mask;
+
+    for (; disk.index[i]; i = (i + 1) & mask)
+        if (strcmp(disk.entries[disk.index[i] - 1].key, key) == 0)
+            break;
+    return &disk.index[i];
+}
+
+/* A later entry for the same key replaces the earlier one, in the file too */
+static void
+fontdisk_add(const char *key, const char *pattern)
+{
+    size_t *slot;
+
+    /* keep the index under 3/4 full so probing stays short */
+    if ((disk.len + 1) * 4 > disk.index_size * 3) {
+        free(disk.index);
+        disk.index_size = disk.index_size ? disk.index_size * 2 : 64;
+        disk.index = ecalloc(disk.index_size, sizeof(size_t));
+        for (size_t i = 0; i < disk.len; i++)
+            *fontdisk_slot(disk.entries[i].key) = i + 1;
+    }
+
+    slot = fontdisk_slot(key);
+    if (*slot) {
+        free(disk.entries[*slot - 1].pattern);
+        disk.entries[*slot - 1].pattern = strdup(pattern);
+        return;
+    }
+
+    if (disk.len == disk.size) {
+        disk.size = disk.size ? disk.size * 2 : 16;
+        if (!(disk.entries = realloc(disk.entries, disk.size * sizeof(FontDiskEntry))))
+            die("realloc:");
+    }
+    disk.entries[disk.len].key = strdup(key);
+    disk.entries[disk.len++].pattern = strdup(pattern);
+    *slot = disk.len;
+}
+
+/* A key of any length, font names are not limited */
+static char *
+fontdisk_key(const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+    char *key;
+
+    va_start(ap, fmt);
+    len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    key = ecalloc(len + 1, 1);
+    va_start(ap, fmt);
+    vsnprintf(key, len + 1, fmt, ap);
+    va_end(ap);
+    return key;
+}
+
+static FILE *
+fontdisk_open_file(void)
+{
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char dir[4096];
+    char path[4096 + 16];
+
+    if (base && *base)
+        snprintf(dir, sizeof(dir), "%s/light-status", base);
+    else if (home && *home)
+        snprintf(dir, sizeof(dir), "%s/.cache/light-status", home);
+    else
+        return NULL;
+
+    /* like mkdir -p, the cache directory itself may be missing on a fresh home */
+    for (char *slash = dir + 1; (slash = strchr(slash, '/')) != NULL; *slash++ = '/') {
+        *slash = '\0';
+        mkdir(dir, 0700);
+    }
+    mkdir(dir, 0700);
+
+    snprintf(path, sizeof(path), "%s/fonts", dir);
+    return fopen(path, "a+");
+}
+
+static void
+fontdisk_load(void)
+{
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    char header[64];
+
+    disk.loaded = true;
+    if (!(disk.file = fontdisk_open_file()))
+        return;
+
+    snprintf(
+        header, sizeof(header), FONTDISK_MAGIC " %ld %016" PRIx64 "\n",
+        fontconfig_stamp(), disk.xft_stamp
+    );
+    rewind(disk.file);
+    if ((len = getline(&line, &line_size, disk.file)) < 0 || strcmp(line, header) != 0) {
+        /* made for another font setup, start over */
+        if (ftruncate(fileno(disk.file), 0) != 0) {
+            fclose(disk.file);
+            disk.file = NULL;
+        } else {
+            fputs(header, disk.file);
+            fflush(disk.file);
+        }
+        free(line);
+        return;
+    }
+
+    /* <key>\t<pattern>, the key has tabs of its own so the pattern is after the last one */
+    while ((len = getline(&line, &line_size, disk.file)) > 0) {
+        if (line[len - 1] == '\n')
+            line[--len] = '\0';
+        char *tab = strrchr(line, '\t');
+        if (!tab)
+            continue;
+        *tab = '\0';
+        fontdisk_add(line, tab + 1);
+    }
+    free(line);
+}
+
+static const char *
+fontdisk_get(const char *key)
+{
+    size_t *slot;
+
+    if (!disk.loaded || !disk.len)
+        return NULL;
+    slot = fontdisk_slot(key);
+    return *slot ? disk.entries[*slot - 1].pattern : NULL;
+}
+
+static void
+fontdisk_put(const char *key, FcPattern *match)
+{
+    FcChar8 *unparsed = NULL;
+
+    if (!disk.loaded || !disk.file || strchr(key, '\n'))
+        return;
+
+    if (match) {
+        /* The languages are not needed to open the font. The charset is kept:
+         * without it XftFontOpenPattern scans the whole cmap of the face,
+         * which for icon and CJK fonts costs more than the match it saves. */
+        FcPattern *slim = FcPatternDuplicate(match);
+        FcPatternDel(slim, FC_LANG);
+        unparsed = FcNameUnparse(slim);
+        FcPatternDestroy(slim);
+        if (!unparsed || strchr((char *)unparsed, '\n')) {
+            free(unparsed);
+            return;
+        }
+    }
+
+    const char *pattern = unparsed ? (const char *)unparsed : "";
+    fontdisk_add(key, pattern);
+    fprintf(disk.file, "%s\t%s\n", key, pattern);
+    fflush(disk.file);
+    free(unparsed);
+}
+
+void
+fontdisk_open(Display *dpy, int screen)
+{
+    /* XftFontMatch bakes these into every stored pattern, the pixel size from the dpi above all */
+    static const char *resources[] = {
+        "dpi", "antialias", "hinting", "hintstyle", "rgba", "lcdfilter", "autohint", "embolden", "scale",
+    };
+    char settings[1024];
+    int len = 0;
+
+    if (disk.loaded)
+        return;
+
+    /* without Xft.dpi, Xft derives it from the screen size */
+    len += snprintf(
+        settings, sizeof(settings), "%d/%d",
+        DisplayHeight(dpy, screen), DisplayHeightMM(dpy, screen)
+    );
+    for (size_t i = 0; i < sizeof(resources) / sizeof(resources[0]); i++) {
+        const char *value = XGetDefault(dpy, "Xft", resources[i]);
+        if (len < (int)sizeof(settings))
+            len += snprintf(settings + len, sizeof(settings) - len, "\t%s", value ? value : "");
+    }
+    disk.xft_stamp = hash_bytes(settings, MIN(len, (int)sizeof(settings) - 1));
+    fontdisk_load();
+}
+
+FcPattern *
+fontdisk_font(const char *name)
+{
+    char *key = fontdisk_key("font\t%s", name);
+    const char *pattern = fontdisk_get(key);
+
+    free(key);
+    if (!pattern || !*pattern)
+        return NULL;
+    return FcNameParse((const FcChar8 *)pattern);
+}
+
+void
+fontdisk_store_font(const char *name, FcPattern *match)
+{
+    char *key = fontdisk_key("font\t%s", name);
+
+    fontdisk_put(key, match);
+    free(key);
+}
+
+bool
+fontdisk_fallback(const char *base, long codepoint, FcPattern **match)
+{
+    char *key = fontdisk_key("fallback\t%s\t%lx", base, codepoint);
+    const char *pattern = fontdisk_get(key);
+
+    free(key);
+    if (!pattern)
+        return false;
+    *match = *pattern ? FcNameParse((const FcChar8 *)pattern) : NULL;
+    return true;
+}
+
+void
+fontdisk_store_fallback(const char *base, long codepoint, FcPattern *match)
+{
+    char *key = fontdisk_key("fallback\t%s\t%lx", base, codepoint);
+
+    fontdisk_put(key, match);
+    free(key);
+}
@@ -0,0 +1,59 @@
+#ifndef FONTDISK_H
+#define FONTDISK_H
+
+#include <stdbool.h>
+#include <fontconfig/fontconfig.h>
+#include <X11/Xlib.h>
+
+/*
+ * Fonts resolved by earlier runs, kept in $XDG_CACHE_HOME/light-status/fonts
+ * so a cold start opens them straight from their matched patterns instead of
+ * running fontconfig's matching again. The file is thrown away whenever the
+ * fontconfig configuration, font directories or caches are newer than it, or
+ * the Xft settings of the X resources (Xft.dpi and the like) change.
+ */
+
+/**
+ * Load the cache made for the display's Xft settings, before any look up
+ * 
+ * @param dpy The display whose Xft resources the matches depend on
+ * @param screen The screen number
+ */
+void fontdisk_open(Display *dpy, int screen);
+
+/**
+ * The pattern a font name matched last time
+ * 
+ * @param name The font name as given by the user
+ * @return A pattern ready for XftFontOpenPattern, owned by the caller, or NULL
+ */
+FcPattern *fontdisk_font(const char *name);
+
+/**
+ * Remember what a font name matched
+ * 
+ * @param name The font name as given by the user
+ * @param match The result of XftFontMatch
+ */
+void fontdisk_store_font(const char *name, FcPattern *match);
+
+/**
+ * The fallback font found for a codepoint last time
+ * 
+ * @param base The unparsed pattern of the first font, fallbacks depend on it
+ * @param codepoint The codepoint no configured font has
+ * @param match Set to a pattern owned by the caller, NULL if no font had the codepoint
+ * @return false if the codepoint was never looked up
+ */
+bool fontdisk_fallback(const char *base, long codepoint, FcPattern **match);
+
+/**
+ * Remember the fallback font for a codepoint
+ * 
+ * @param base The unparsed pattern of the first font
+ * @param codepoint The codepoint
+ * @param match The matched pattern, NULL if no font has the codepoint
+ */
+void fontdisk_store_fallback(const char *base, long codepoint, FcPattern *match);
+
+#endif /* FONTDISK_H */
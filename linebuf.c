@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "linebuf.h"
+#include "util.h"
+
+
+/* never read less than this at once */
+#define LINEBUF_CHUNK 4096
+
+
+void
+linebuf_init(LineBuf *lb, size_t max_len)
+{
+    memset(lb, 0, sizeof(LineBuf));
+    lb->max_len = max_len;
+    lb->size = LINEBUF_CHUNK * 2;
+    lb->data = ecalloc(lb->size, 1);
+}
+
+void
+linebuf_free(LineBuf *lb)
+{
+    free(lb->data);
+    lb->data = NULL;
+    lb->size = 0;
+}
+
+/* Move the newest line and the unfinished tail to the front, grow if that is not enough */
+static void
+linebuf_make_room(LineBuf *lb)
+{
+    size_t keep_len = lb->has_last ? lb->last_len + 1 : 0;
+    size_t tail_len = lb->end - lb->start;
+
+    if (lb->has_last && lb->last != 0)
+        memmove(lb->data, lb->data + lb->last, keep_len);
+    if (lb->start != keep_len)
+        memmove(lb->data + keep_len, lb->data + lb->start, tail_len);
+
+    lb->scan -= lb->start - keep_len;
+    lb->start = keep_len;
+    lb->end = keep_len + tail_len;
+    lb->last = 0;
+
+    /* one extra byte is always left to terminate an unfinished line */
+    if (lb->size - lb->end < LINEBUF_CHUNK + 1) {
+        while (lb->size - lb->end < LINEBUF_CHUNK + 1)
+            lb->size *= 2;
+        if (!(lb->data = realloc(lb->data, lb->size)))
+            die("realloc:");
+    }
+}
+
+ssize_t
+linebuf_fill(LineBuf *lb, int fd)
+{
+    if (lb->size - lb->end < LINEBUF_CHUNK + 1)
+        linebuf_make_room(lb);
+
+    ssize_t len = read(fd, lb->data + lb->end, lb->size - lb->end - 1);
+    if (len > 0)
+        lb->end += len;
+    return len;
+}
+
+static char *
+linebuf_take(LineBuf *lb, size_t start, size_t len)
+{
+    lb->data[start + len] = '\0';
+    lb->last = start;
+    lb->last_len = len;
+    lb->has_last = true;
+    return lb->data + start;
+}
+
+char *
+linebuf_next(LineBuf *lb, size_t *len)
+{
+    char *line_end;
+
+    while ((line_end = memchr(lb->data + lb->scan, '\n', lb->end - lb->scan)) != NULL) {
+        size_t start = lb->start;
+
+        lb->start = lb->scan = line_end - lb->data + 1;
+        if (lb->discarding) {
+            /* the end of a line that was already cut */
+            lb->discarding = false;
+            continue;
+        }
+
+        *len = MIN((size_t)(line_end - lb->data) - start, lb->max_len);
+        return linebuf_take(lb, start, *len);
+    }
+    lb->scan = lb->end;
+
+    if (lb->discarding) {
+        lb->start = lb->end;
+    } else if (lb->end - lb->start > lb->max_len) {
+        /* do not keep growing for input that never ends its line */
+        size_t start = lb->start;
+        lb->start = lb->end;
+        lb->discarding = true;
+        *len = lb->max_len;
+        return linebuf_take(lb, start, *len);
+    }
+    return NULL;
+}
+
+char *
+linebuf_rest(LineBuf *lb, size_t *len)
+{
+    size_t start = lb->start;
+
+    lb->start = lb->scan = lb->end;
+    if (lb->discarding || start == lb->end) {
+        lb->discarding = false;
+        return NULL;
+    }
+
+    *len = MIN(lb->end - start, lb->max_len);
+    return linebuf_take(lb, start, *len);
+}
+
+const char *
+linebuf_last(LineBuf *lb)
+{
+    return lb->has_last ? lb->data + lb->last : "";
+}
@@ -0,0 +1,77 @@
+#ifndef LINEBUF_H
+#define LINEBUF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Growable read(2) buffer that splits its content into lines in place.
+ *
+ * Lines are handed out as pointers into the buffer, so nothing is copied
+ * between read(2) and the renderer. The newest line stays valid until the
+ * next one is returned: when the buffer runs out of space it is compacted
+ * to the front, keeping only that line and the unfinished tail, and only
+ * grows when a single line does not fit. Once grown, the space is reused.
+ */
+typedef struct LineBuf {
+    char *data;
+    size_t size;
+    size_t start;  // first byte of the unfinished line
+    size_t end;  // one past the last byte read
+    size_t scan;  // the newline search resumes here
+    size_t last;  // the newest returned line, kept across compaction
+    size_t last_len;
+    size_t max_len;  // longer lines are cut, the rest up to the newline is dropped
+    bool has_last;
+    bool discarding;
+} LineBuf;
+
+/**
+ * Prepare an empty buffer
+ * 
+ * @param lb The buffer to initialize
+ * @param max_len Lines longer than this are cut
+ */
+void linebuf_init(LineBuf *lb, size_t max_len);
+
+void linebuf_free(LineBuf *lb);
+
+/**
+ * Read one chunk from fd into the buffer
+ * 
+ * Pointers returned earlier, except linebuf_last, are invalidated.
+ * 
+ * @param lb The buffer
+ * @param fd The descriptor to read from
+ * @return Like read(2): the number of bytes read, 0 at end of file, -1 on error
+ */
+ssize_t linebuf_fill(LineBuf *lb, int fd);
+
+/**
+ * Take the next complete line
+ * 
+ * @param lb The buffer
+ * @param len Set to the line length, without the newline
+ * @return The NUL terminated line or NULL if there is no complete line yet
+ */
+char *linebuf_next(LineBuf *lb, size_t *len);
+
+/**
+ * Take the unterminated rest of the data, for when the input has ended
+ * 
+ * @param lb The buffer
+ * @param len Set to the line length
+ * @return The NUL terminated line or NULL if nothing is left
+ */
+char *linebuf_rest(LineBuf *lb, size_t *len);
+
+/**
+ * The newest line returned by linebuf_next or linebuf_rest
+ * 
+ * @param lb The buffer
+ * @return The line, or an empty string if none was returned yet
+ */
+const char *linebuf_last(LineBuf *lb);
+
+#endif /* LINEBUF_H */
@@ -3,18 +3,24 @@
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <X11/Xft/Xft.h>
-#ifdef USE_XINERAMA
-    #include <X11/extensions/Xinerama.h>
-#endif
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
 
-#include "drw.h"
 #include "geometry.h"
 #include "util.h"
+#include "stats.h"
+#include "segment.h"
+#include "ctlsock.h"
+#include "panel.h"
+#include "monitors.h"
+#include "follow.h"
 
 
 #define ALIGNMENT_ASSIGN_STR(alignment, parameter, str) \
@@ -26,10 +32,12 @@
 
 
 #define MONITOR_FOCUSED -1
+#define MONITOR_ACTIVE -2
 
 #define MONITOR_ASSIGN_STR(monitor, str) \
     switch (str[0]) { \
         case 'F': monitor = MONITOR_FOCUSED; break; \
+        case 'A': monitor = MONITOR_ACTIVE; break; \
         default: monitor = atoi(str); break; \
     }
 
@@ -95,33 +103,51 @@ int parse_monitors(const char *str, MonitorSpec ** monitors) {
 
 #include "config.h"
 
-static volatile FILE *status_data_pipe = NULL;
+static Panel *panels = NULL;
+static int panels_len = 0;
+static MonitorSpec *monitors = NULL;
+static MonitorTable monitor_table;
+static Follow follow;
+static volatile sig_atomic_t stats_requested = 0;
+static volatile sig_atomic_t quit_requested = 0;
 
 
 static void
 on_close(void)
 {
-    if (status_data_pipe != NULL) {
-        pclose((FILE *)status_data_pipe);
-        status_data_pipe = NULL;
-    }
+    for (int i = 0; i < panels_len; i++)
+        panel_close_sources(&panels[i]);
 }
 
+/* closing the sources frees memory and waits for commands, so it happens in the main loop */
 static void
 sig_handler(int sig)
 {
-    on_close();
-    kill(0, 15);
-    exit(0);
+    quit_requested = 1;
 }
 
+static void
+stats_sig_handler(int sig)
+{
+    stats_requested = 1;
+}
 
+
+/*
+ * The monitor a panel goes on: the -Xd spec with the preferred index when
+ * specs are given, the preferred monitor of the table otherwise, or the one
+ * under the pointer when there is no such monitor. Sets index to the monitor
+ * picked from the table, -1 for a spec.
+ */
 Rect
-decide_screen_rect(Display *dpy, int default_screen, int preferred_screen, MonitorSpec *monitors)
+decide_screen_rect(
+    Display *dpy, int default_screen, int preferred_screen,
+    MonitorSpec *monitors, const MonitorTable *table, int *index
+)
 {
     Rect rect;
-    bool xineramaIsOk = false;
 
+    *index = -1;
     if (monitors) {
         rect = monitors->rect;
 
@@ -141,143 +167,33 @@ decide_screen_rect(Display *dpy, int default_screen, int preferred_screen, Monit
         return rect;
     }
 
-#ifdef USE_XINERAMA
-    int _dummy1, _dummy2;
-
-    Window root_window = XDefaultRootWindow(dpy);
-    Window window_returned;
-    int mouse_x, mouse_y;
-    unsigned int mask_return;
     int current_screen_index = default_screen;
 
-    XineramaScreenInfo * screens = NULL;
-    XineramaScreenInfo * screen = NULL;
-    int heads=0;
-    
-    if (!XineramaQueryExtension(dpy, &_dummy1, &_dummy2)) {
-        printf("Xinerama not supported\n");
-        goto xinerama_end;
-    }
-    if (!XineramaIsActive(dpy)) {
-        printf("Xinerama not active\n");
-        goto xinerama_end;
-    }
-    
-    screens = XineramaQueryScreens(dpy, &heads);
-    if (!screens) {
-        printf("XineramaQueryScreens failed\n");
-        goto xinerama_end;
-    }
-    if (heads < 1) {
-        printf("No screens found\n");
-        goto xinerama_end;
-    }
-
-    if (preferred_screen >= 0 && preferred_screen < heads) {
+    if (preferred_screen >= 0 && preferred_screen < table->len) {
         current_screen_index = preferred_screen;
-    } else {
-        Rect screen_space;
-        Rect current_screen;
-
-        for (int i = 0; i < heads; i++) {
-            screen = screens + i;
-            current_screen.x = screen->x_org;
-            current_screen.y = screen->y_org;
-            current_screen.w = screen->width;
-            current_screen.h = screen->height;
-
-            if (i == 0) {
-                screen_space = current_screen;
-            } else {
-                add_rect(&screen_space, &current_screen);
-            }
-        }
-
-        if (!XQueryPointer(
-            dpy, root_window, &window_returned,
+    } else if (table->len > 1) {
+        int _dummy1, _dummy2;
+        Window window_returned;
+        int mouse_x, mouse_y;
+        unsigned int mask_return;
+
+        if (XQueryPointer(
+            dpy, XDefaultRootWindow(dpy), &window_returned,
             &window_returned, &mouse_x, &mouse_y, &_dummy1, &_dummy2,
             &mask_return
         )) {
-            printf("XQueryPointer failed\n");
-            goto xinerama_end;
-        }
-
-        for (int i = 0; i < heads; i++) {
-            screen = screens + i;
-            if (
-                mouse_x >= screen->x_org && mouse_x < screen->x_org + screen->width &&
-                mouse_y >= screen->y_org && mouse_y < screen->y_org + screen->height
-            ) {
+            int i = monitors_at(table, mouse_x, mouse_y);
+            if (i >= 0)
                 current_screen_index = i;
-                break;
-            }
+        } else {
+            printf("XQueryPointer failed\n");
         }
     }
+    if (current_screen_index < 0 || current_screen_index >= table->len)
+        current_screen_index = 0;
 
-    screen = screens + current_screen_index;
-    rect.x = screen->x_org;
-    rect.y = screen->y_org;
-    rect.w = screen->width;
-    rect.h = screen->height;
-
-    xineramaIsOk = true;
-
-xinerama_end:
-    
-    if (screens) {
-        XFree(screens);
-    }
-#endif
-
-    if (!xineramaIsOk) {
-        rect.w = DisplayWidth(dpy, default_screen);
-        rect.h = DisplayHeight(dpy, default_screen);
-        rect.x = 0;
-        rect.y = 0;
-    }
-
-    return rect;
-}
-
-
-int
-normalize_u8_string(signed char *str, size_t len)
-{
-    int i = 0;
-    
-    while (str[i] > 0) {
-ascii:
-        if (str[i] == '\n') {
-            if (i == len - 1) {
-                str[i] = '\0';
-                len--;
-                return len;
-            }else {
-                str[i] = ' ';
-            }
-        }
-		i++;
-	}
-
-	while (str[i]) {
-		if (str[i] > 0) {
-			goto ascii;
-		} else {
-			switch (0xF0 & str[i]) {
-			case 0xE0:
-				i += 3;
-				break;
-			case 0xF0:
-				i += 4;
-				break;
-			default:
-				i += 2;
-				break;
-			}
-		}
-	}
-	
-	return len;
+    *index = current_screen_index;
+    return table->rects[current_screen_index];
 }
 
 
@@ -289,31 +205,64 @@ print_help(const char *program_name)
         "Things marked !W or !X are only for Wayland or Xorg setups.\n\n"
         C_GREEN "Flags:\n" C_RESET
         "    --help              - display help\n"
-        "    -i <data-command>   - data collection command\n\n"
+        "    -i <data-command>   - data collection command, repeat to show several side by side\n"
+        "    -B <builtin>        - built-in data source, shown in order with the commands\n"
+        "    -Bi <milliseconds>  - update interval of the built-in sources\n"
+        "    -S <socket-path>    - listen for status lines on a unix socket, shown in order with the commands\n"
+        "    --send <socket-path> [<text>...] - send <text>, or every line of stdin, to a running instance\n"
+        "    -D <panel-list>     - run several panels from one process, one per line of the file\n"
+        "    -F <max-fps>        - draw at most <max-fps> frames per second, only the newest line is shown\n"
+        "    -Fp <frames>        - hold new frames while this many are not yet confirmed by the X server\n"
+        "    -R <milliseconds>   - restart a stopped data command after this delay, doubling while it keeps\n"
+        "                          stopping, 0 to quit instead\n\n"
         "        PANEL CONFIG\n"
         "    -w <width>          - panel width\n"
         "    -h <height>         - panel height\n"
         "    -[l,r,t,b] <align>  - panel left, right, top and bottom alignment\n"
-        "    -c <color>          - panel color\n\n"
+        "    -c <color>          - panel color\n"
+        "    -A <0|1>            - fit the panel to its text, -w and -h become the largest size\n"
+        "    -Ap <pixels>        - padding around the text of a fitted panel\n"
+        "    -As <pixels>        - a fitted panel's width grows and shrinks in steps of this size\n"
+        "    -Ad <milliseconds>  - a fitted panel shrinks once its text stayed smaller this long\n\n"
         "        TEXT CONFIG\n"
         "    -T[l,r,t,b] <value> - text left, right, top and bottom alignment\n"
         "    -Tf <font>          - font pattern\n"
-        "    -Tc <color>         - text color\n\n"
+        "    -Tc <color>         - text color\n"
+        "    -Td <color>         - color of the last line of a stopped data command until it is restarted\n"
+        "    -Tm <0|1>           - parse color and font markup in the text, off by default\n\n"
         "        XORG PROPERTIES\n"
         "    -Xn <name>             - window name\n"
         "    -Xc <class>            - window class\n"
         "    -Xm <monitor index>    - monitor number\n"
         "    -Xd <monitor spec>[,<monitor spec>...] - monitor spec\n"
+        "    -Xs <0|1>              - draw on the client and present through MIT-SHM, local displays only\n\n",
+        program_name
+    );
+    printf(
         C_GREEN "<data-command>" C_RESET " is a command that will be executed with popen() to show its output.\n"
         "    The command should periodically return a value, for example:\n"
         "        \"while true; do echo `date`; sleep 1; done\"\n"
         "    or\n"
         "        \"slstatus -s\"\n\n"
+        C_GREEN "<builtin>" C_RESET " is read in-process without running any command:\n"
+        "    clock[:<strftime format>] - current time, %%H:%%M:%%S by default\n"
+        "    cpu                       - CPU usage since the previous update\n"
+        "    mem                       - used memory\n"
+        "    load                      - load average\n"
+        "    battery[:<name>]          - battery charge, BAT0 by default\n"
+        "    thermal[:<zone>]          - temperature, thermal_zone0 by default\n\n"
+        C_GREEN "<socket-path>" C_RESET " accepts up to 16 clients at once writing newline terminated lines,\n"
+        "    the newest line from any of them is shown.\n\n"
         C_GREEN "<align>" C_RESET " can be:\n"
         "    C - center\n"
         "    U - unset (default)\n"
         "    <number> - offset in pixels\n\n"
         C_GREEN "<color>" C_RESET " should be in hex format with leading # (#000fff)\n\n"
+        C_GREEN "<markup>" C_RESET " switches the style of the text after it:\n"
+        "    ^fg(<color>) - text color, ^fg() for the panel's one\n"
+        "    ^bg(<color>) - background color, ^bg() for the panel's one\n"
+        "    ^fn(<index>) - font from the configured list, 0 or ^fn() for the usual ones\n"
+        "    ^^           - a literal ^\n\n"
         C_GREEN "<font>" C_RESET " should be in pattern: <font-name>[:size=<font-size>]\n"
         "    " C_GREEN "<font-name>" C_RESET " can be:\n"
         "       actual name\n"
@@ -321,72 +270,85 @@ print_help(const char *program_name)
         C_GREEN "<monitor index>" C_RESET " can be:\n"
         "    0 - primary monitor\n"
         "    <number> - other monitors\n"
-        "    F - focused monitor, deduced from mouse position\n\n"
+        "    F - focused monitor, deduced from mouse position\n"
+        "    A - the monitor of the active window, the panel moves along when focus changes\n\n"
         C_GREEN "<monitor spec>" C_RESET " is:\n"
-        "    <name>:<index>:<w>:<h>:<x>:<y> - monitor name, index, width, height, x, y\n\n",
-        program_name
+        "    <name>:<index>:<w>:<h>:<x>:<y> - monitor name, index, width, height, x, y\n\n"
+        C_GREEN "<panel-list>" C_RESET " lines hold the panel flags above, quoted like in a shell, for example:\n"
+        "        -w 300 -h 30 -l 0 -t 0 -B clock\n"
+        "        -w 300 -h 30 -r 0 -t 0 -i \"slstatus -s\" -Tc \"#ff0000\"\n"
+        "    Flags given on the command line are the defaults for every line. Panels with the same\n"
+        "    fonts or colors share them, and all of them share one X connection. A line without\n"
+        "    sources runs its own copy of the command line's -i and -B sources; -S is not inherited.\n\n"
+        "Panels follow their monitor when monitors are plugged in, out or moved (RandR), except with -Xd.\n\n"
+        "Send SIGUSR1 to print runtime counters (lines read, coalesced, frames drawn and skipped) to stderr.\n\n"
+        "Resolved fonts are kept in $XDG_CACHE_HOME/light-status/fonts (~/.cache by default) for faster starts,\n"
+        "it is rebuilt whenever the fontconfig setup or the Xft resources (Xft.dpi etc.) change.\n\n"
     );
 }
 
 
-int
-main (int argc, const char *argv[])
-{
-    signal(SIGINT, sig_handler);
-    signal(SIGTERM, sig_handler);
-    signal(SIGKILL, sig_handler);
 
-    const char **fonts = default_fonts;
-    int fonts_len = sizeof(default_fonts) / sizeof(char*);
-    const char *status_collecting_command = default_status_collecting_command;
+/* Apply the flags in args to cfg; process-wide flags are only handled when panel_list is given */
+static void
+parse_args(PanelConfig *cfg, int argc, const char *argv[], const char **panel_list, const char *program_name)
+{
     const char *cur_arg;
-    const char *color_scheme[] = {
-        default_text_color,
-        default_background_color
-    };
-    char * window_name = default_window_name;
-    char * window_class = default_window_class;
 
-    MonitorSpec *monitors = NULL;
-
-#ifdef USE_ARGS
-    for (int i = 1; i < argc; i++) {
+    for (int i = 0; i < argc; i++) {
         cur_arg = argv[i];
         
         if (cur_arg[0] == '-') switch (cur_arg[1]) {
             // --<x>
             case '-':
+                if (!panel_list)
+                    break;
                 if (strcmp(cur_arg+2, "help") == 0) {
-                    print_help(argv[0]);
+                    print_help(program_name);
                     exit(0);
                 }
+                if (strcmp(cur_arg+2, "send") == 0) {
+                    if (i + 1 >= argc) {
+                        printf("--send needs a socket path\n");
+                        exit(1);
+                    }
+                    exit(ctlsock_send(argv[i + 1], argc - i - 2, argv + i + 2));
+                }
                 break;
             // -T<x>
             case 'T':
                 switch (cur_arg[2]) {
                     case 'l':
                         cur_arg = argv[++i];
-                        ALIGNMENT_ASSIGN_STR(text_alignment, left, cur_arg);
+                        ALIGNMENT_ASSIGN_STR(cfg->text_alignment, left, cur_arg);
                         break;
                     case 'r':
                         cur_arg = argv[++i];
-                        ALIGNMENT_ASSIGN_STR(text_alignment, right, cur_arg);
+                        ALIGNMENT_ASSIGN_STR(cfg->text_alignment, right, cur_arg);
                         break;
                     case 't':
                         cur_arg = argv[++i];
-                        ALIGNMENT_ASSIGN_STR(text_alignment, top, cur_arg);
+                        ALIGNMENT_ASSIGN_STR(cfg->text_alignment, top, cur_arg);
                         break;
                     case 'b':
                         cur_arg = argv[++i];
-                        ALIGNMENT_ASSIGN_STR(text_alignment, bottom, cur_arg);
+                        ALIGNMENT_ASSIGN_STR(cfg->text_alignment, bottom, cur_arg);
                         break;
                     case 'f':
-                        fonts_len = 1;
-                        fonts = argv + (++i);
+                        cfg->fonts_len = 1;
+                        cfg->fonts = argv + (++i);
                         break;
                     case 'c':
                         cur_arg = argv[++i];
-                        color_scheme[0] = cur_arg;
+                        cfg->colors[0] = cur_arg;
+                        break;
+                    case 'd':
+                        cur_arg = argv[++i];
+                        cfg->colors[2] = cur_arg;
+                        break;
+                    case 'm':
+                        cur_arg = argv[++i];
+                        cfg->markup = atoi(cur_arg) != 0;
                         break;
                 }
                 break;
@@ -394,17 +356,23 @@ main (int argc, const char *argv[])
             case 'X':
                 switch (cur_arg[2]) {
                     case 'n':
-                        window_name = (char*)argv[++i];
+                        cfg->window_name = (char*)argv[++i];
                         break;
                     case 'c':
-                        window_class = (char*)argv[++i];
+                        cfg->window_class = (char*)argv[++i];
                         break;
                     case 'm':
                         cur_arg = argv[++i];
-                        MONITOR_ASSIGN_STR(monitor, cur_arg);
+                        MONITOR_ASSIGN_STR(cfg->monitor, cur_arg);
+                        break;
+                    case 's':
+                        cur_arg = argv[++i];
+                        cfg->shm = atoi(cur_arg) != 0;
                         break;
                     case 'd':
                         cur_arg = argv[++i];
+                        if (!panel_list)
+                            break;
                         if (parse_monitors(cur_arg, &monitors) == E_MONITOR_SPEC_PARSE_WRONG_FORMAT) {
                             printf("Wrong monitor spec format, expected <name>:<index>:<w>:<h>:<x>:<y>\n");
                             exit(1);
@@ -415,135 +383,450 @@ main (int argc, const char *argv[])
             // -<x>
             case 'l':
                 cur_arg = argv[++i];
-                ALIGNMENT_ASSIGN_STR(panel_alignment, left, cur_arg);
+                ALIGNMENT_ASSIGN_STR(cfg->alignment, left, cur_arg);
                 break;
             case 'r':
                 cur_arg = argv[++i];
-                ALIGNMENT_ASSIGN_STR(panel_alignment, right, cur_arg);
+                ALIGNMENT_ASSIGN_STR(cfg->alignment, right, cur_arg);
                 break;
             case 't':
                 cur_arg = argv[++i];
-                ALIGNMENT_ASSIGN_STR(panel_alignment, top, cur_arg);
+                ALIGNMENT_ASSIGN_STR(cfg->alignment, top, cur_arg);
                 break;
             case 'b':
                 cur_arg = argv[++i];
-                ALIGNMENT_ASSIGN_STR(panel_alignment, bottom, cur_arg);
+                ALIGNMENT_ASSIGN_STR(cfg->alignment, bottom, cur_arg);
+                break;
+            case 'A':
+                switch (cur_arg[2]) {
+                    case 'p':
+                        cur_arg = argv[++i];
+                        cfg->autosize_padding = atoi(cur_arg);
+                        break;
+                    case 's':
+                        cur_arg = argv[++i];
+                        cfg->autosize_step = atoi(cur_arg);
+                        break;
+                    case 'd':
+                        cur_arg = argv[++i];
+                        cfg->autosize_shrink_ms = atoi(cur_arg);
+                        break;
+                    case '\0':
+                        cur_arg = argv[++i];
+                        cfg->autosize = atoi(cur_arg) != 0;
+                        break;
+                }
                 break;
             case 'w':
                 cur_arg = argv[++i];
-                panel_rect.w = atoi(cur_arg);
+                cfg->rect.w = atoi(cur_arg);
                 break;
             case 'h':
                 cur_arg = argv[++i];
-                panel_rect.h = atoi(cur_arg);
+                cfg->rect.h = atoi(cur_arg);
                 break;
             case 'c':
                 cur_arg = argv[++i];
-                color_scheme[1] = cur_arg;
+                cfg->colors[1] = cur_arg;
                 break;
             case 'i':
-                status_collecting_command = argv[++i];
+                cfg->sources[cfg->sources_len].value = argv[++i];
+                cfg->sources[cfg->sources_len++].type = SOURCE_COMMAND;
+                break;
+            case 'S':
+                cfg->sources[cfg->sources_len].value = argv[++i];
+                cfg->sources[cfg->sources_len++].type = SOURCE_SOCKET;
+                break;
+            case 'B':
+                switch (cur_arg[2]) {
+                    case 'i':
+                        cur_arg = argv[++i];
+                        cfg->builtin_interval_ms = atoi(cur_arg);
+                        break;
+                    case '\0':
+                        cfg->sources[cfg->sources_len].value = argv[++i];
+                        cfg->sources[cfg->sources_len++].type = SOURCE_BUILTIN;
+                        break;
+                }
                 break;
+            case 'F':
+                switch (cur_arg[2]) {
+                    case 'p':
+                        cur_arg = argv[++i];
+                        cfg->max_pending_frames = atoi(cur_arg);
+                        break;
+                    case '\0':
+                        cur_arg = argv[++i];
+                        cfg->max_fps = atoi(cur_arg);
+                        break;
+                }
+                break;
+            case 'R':
+                cur_arg = argv[++i];
+                cfg->restart_delay_ms = atoi(cur_arg);
+                break;
+            case 'D':
+                cur_arg = argv[++i];
+                if (panel_list)
+                    *panel_list = cur_arg;
+                break;
+        }
+    }
+}
+
+/* One panel per non-empty line, on top of the defaults in base. Returns the number of panels. */
+static int
+read_panel_list(const char *path, const PanelConfig *base, PanelConfig **configs)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "error, cannot open panel list '%s'\n", path);
+        return -1;
+    }
+
+    int configs_len = 0;
+    int configs_size = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t line_len;
+
+    *configs = NULL;
+    while ((line_len = getline(&line, &line_size, file)) >= 0) {
+        const char **args = ecalloc(line_len / 2 + 1, sizeof(char *));
+        int args_len = split_args(line, args, line_len / 2 + 1);
+        if (!args_len) {
+            free(args);
+            continue;
+        }
+
+        if (configs_len == configs_size) {
+            configs_size = configs_size ? configs_size * 2 : 8;
+            if (!(*configs = realloc(*configs, configs_size * sizeof(PanelConfig))))
+                die("realloc:");
+        }
+
+        /* the panel keeps pointing into the line, so both live until exit */
+        PanelConfig *cfg = &(*configs)[configs_len++];
+        *cfg = *base;
+        cfg->sources = ecalloc(args_len / 2 + 1, sizeof(SourceSpec));
+        cfg->sources_len = 0;
+        parse_args(cfg, args_len, args, NULL, NULL);
+        if (!cfg->sources_len) {
+            /* every such panel runs its own copy of the commands, but a socket has one listener */
+            for (int i = 0; i < base->sources_len; i++) {
+                if (base->sources[i].type == SOURCE_SOCKET) {
+                    fprintf(
+                        stderr, "error, panel %d of the panel list has no sources, and -S %s can not be shared\n",
+                        configs_len, base->sources[i].value
+                    );
+                    free(args);
+                    free(line);
+                    fclose(file);
+                    return -1;
+                }
+            }
+            cfg->sources = base->sources;
+            cfg->sources_len = base->sources_len;
+        }
+
+        line = NULL;
+        line_size = 0;
+    }
+
+    free(line);
+    fclose(file);
+    return configs_len;
+}
+
+/* Cache of resources that panels with equal settings share */
+typedef struct Shared {
+    const PanelConfig *cfg;
+    void *resource;
+} Shared;
+
+static bool
+same_fonts(const PanelConfig *a, const PanelConfig *b)
+{
+    if (a->fonts_len != b->fonts_len)
+        return false;
+    for (int i = 0; i < a->fonts_len; i++)
+        if (strcmp(a->fonts[i], b->fonts[i]) != 0)
+            return false;
+    return true;
+}
+
+static bool
+same_colors(const PanelConfig *a, const PanelConfig *b)
+{
+    for (int i = 0; i < 3; i++) {
+        if (!a->colors[i] || !b->colors[i]) {
+            if (a->colors[i] != b->colors[i])
+                return false;
+        } else if (strcmp(a->colors[i], b->colors[i]) != 0) {
+            return false;
         }
     }
+    return true;
+}
+
+static Fnt *
+shared_fontset(Drw *drw, const PanelConfig *cfg, Shared *cache, int *cache_len)
+{
+    for (int i = 0; i < *cache_len; i++)
+        if (same_fonts(cache[i].cfg, cfg))
+            return cache[i].resource;
+
+    cache[*cache_len].cfg = cfg;
+    cache[*cache_len].resource = drw_fontset_create(drw, cfg->fonts, cfg->fonts_len);
+    return cache[(*cache_len)++].resource;
+}
+
+static Clr *
+shared_scheme(Drw *drw, const PanelConfig *cfg, Shared *cache, int *cache_len)
+{
+    for (int i = 0; i < *cache_len; i++)
+        if (same_colors(cache[i].cfg, cfg))
+            return cache[i].resource;
+
+    const char *names[PANEL_SCHEME_LEN] = {
+        cfg->colors[0], cfg->colors[1],
+        cfg->colors[2] ? cfg->colors[2] : cfg->colors[0], cfg->colors[1],
+    };
+    cache[*cache_len].cfg = cfg;
+    cache[*cache_len].resource = drw_scm_create(drw, names, PANEL_SCHEME_LEN);
+    return cache[(*cache_len)++].resource;
+}
+
+
+int
+main (int argc, const char *argv[])
+{
+    signal(SIGINT, sig_handler);
+    signal(SIGTERM, sig_handler);
+    signal(SIGKILL, sig_handler);
+    signal(SIGUSR1, stats_sig_handler);
+    stats_trace_open(getenv("LIGHT_STATUS_TRACE"));
+
+    PanelConfig base = {
+        .rect = panel_rect,
+        .alignment = panel_alignment,
+        .text_alignment = text_alignment,
+        .fonts = default_fonts,
+        .fonts_len = sizeof(default_fonts) / sizeof(char*),
+        .colors = {
+            default_text_color,
+            default_background_color,
+            default_stale_text_color
+        },
+        .window_name = default_window_name,
+        .window_class = default_window_class,
+        .monitor = monitor,
+        .markup = text_markup,
+        .max_fps = max_fps,
+        .max_pending_frames = max_pending_frames,
+        .shm = client_rendering,
+        .autosize = autosize,
+        .autosize_padding = autosize_padding,
+        .autosize_step = autosize_step,
+        .autosize_shrink_ms = autosize_shrink_ms,
+        .builtin_interval_ms = builtin_interval_ms,
+        .restart_delay_ms = restart_delay_ms,
+        .restart_max_delay_ms = restart_max_delay_ms,
+        .max_status_len = max_status_len,
+        /* commands, built-in sources and control sockets, in command line order */
+        .sources = ecalloc(argc / 2 + 1, sizeof(SourceSpec)),
+    };
+    const char *panel_list = NULL;
+
+#ifdef USE_ARGS
+    parse_args(&base, argc - 1, argv + 1, &panel_list, argv[0]);
 #endif
 
-    status_data_pipe = popen(status_collecting_command, "r");
-    if (status_data_pipe == NULL) {
-        printf("Failed to run the command\n");
+    if (base.sources_len == 0) {
+        base.sources[0].value = default_status_collecting_command;
+        base.sources[base.sources_len++].type = SOURCE_COMMAND;
+    }
+
+    PanelConfig *configs = &base;
+    int configs_len = 1;
+    if (panel_list && (configs_len = read_panel_list(panel_list, &base, &configs)) <= 0) {
+        /* the reason was printed already when the list could not be used */
+        if (configs_len == 0)
+            printf("No panels in the panel list: %s\n", panel_list);
         return 1;
     }
 
+    panels = ecalloc(configs_len, sizeof(Panel));
+    for (; panels_len < configs_len; panels_len++) {
+        if (panel_open_sources(&panels[panels_len], &configs[panels_len]) != 0) {
+            panels_len++;
+            on_close();
+            return 1;
+        }
+    }
+
     Display *dpy = XOpenDisplay(NULL);
     if (!dpy) {
         fprintf(stderr, "Could not open display.\n");
+        on_close();
         return 1;
     }
 
     int screen = DefaultScreen(dpy);
-    Visual *visual = DefaultVisual(dpy, screen);
-    int depth  = DefaultDepth(dpy, screen);
-    Window root_window = DefaultRootWindow(dpy);
+    Shared fontsets[panels_len];
+    Shared schemes[panels_len];
+    int fontsets_len = 0;
+    int schemes_len = 0;
+
+    monitors_query(&monitor_table, dpy, screen);
+    /* -Xd specs are fixed, only real monitors can come and go */
+    if (!monitors)
+        monitors_listen(&monitor_table, dpy, screen);
+
+    /* the active window is only watched if some panel goes where it is */
+    bool following = false;
+    for (int i = 0; i < panels_len; i++)
+        following = following || (panels[i].cfg->monitor == MONITOR_ACTIVE && !monitors);
+    if (following)
+        follow_init(&follow, dpy, screen, follow_interval_ms);
+
+    for (int i = 0; i < panels_len; i++) {
+        Panel *panel = &panels[i];
+        Rect screen_rect = decide_screen_rect(
+            dpy, screen, panel->cfg->monitor,
+            monitors, &monitor_table, &panel->monitor
+        );
 
-    Rect screen_rect = decide_screen_rect(dpy, screen, monitor, monitors);
-    Rect text_rect;
-    char status[max_status_len];
+        panel_create_window(panel, dpy, screen, &screen_rect);
+        panel_set_resources(
+            panel,
+            shared_fontset(panel->drw, panel->cfg, fontsets, &fontsets_len),
+            shared_scheme(panel->drw, panel->cfg, schemes, &schemes_len)
+        );
+    }
 
-    set_alignment(&panel_alignment, &panel_rect, &screen_rect);
-    panel_rect.x += screen_rect.x;
-    panel_rect.y += screen_rect.y;
+    int max_fds = 1;
+    for (int i = 0; i < panels_len; i++)
+        max_fds += PANEL_MAX_FDS(&panels[i]);
 
-    /* Create a simple window with a drawable. */
-    XSetWindowAttributes window_attributes = {
-        .override_redirect = True,
-    };
-    Window window = XCreateWindow(
-        dpy,
-        root_window,  // parent
-        panel_rect.x, panel_rect.y,
-        panel_rect.w, panel_rect.h,
-        0,  // border width
-        depth,  // depth
-        InputOutput,  // class
-        visual,  // visual
-        CWOverrideRedirect,  // value mask
-        &window_attributes
-    );
-    
-    /* set the name and class hints for the window manager to use */
-    XStoreName(dpy, window, window_name);
-    XClassHint * class_hint = XAllocClassHint();
-    if (class_hint) {
-        class_hint->res_name = window_name;
-        class_hint->res_class = window_class;
-    }
-    Atom win_type_atom = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", False);
-    Atom win_utility_atom = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_UTILITY", False);
-    XSetClassHint(dpy, window, class_hint);
-    XChangeProperty(
-        dpy, window,
-        win_type_atom, XA_ATOM, 32,
-        PropModeReplace,
-        (unsigned char *)&win_utility_atom, 1
-    );
-    
-    XMapWindow(dpy, window);
+    /* every panel's descriptors, the X connection goes last */
+    struct pollfd fds[max_fds];
+    int panel_fds[panels_len];
+    XEvent ev;
 
-    Drw *drw = drw_create(dpy, screen, root_window, panel_rect.w, panel_rect.h);
-    drw_fontset_create(drw, fonts, fonts_len);
-    Clr *scheme = drw_scm_create(drw, color_scheme, sizeof(color_scheme) / sizeof(char*));
-    drw_set_scheme(drw, scheme);
+    while (true) {
+        /* Xlib may have queued events while we were reading or drawing */
+        bool monitors_changed = false;
+        while (XPending(dpy)) {
+            XNextEvent(dpy, &ev);
+            if (monitors_handle_event(&monitor_table, &ev)) {
+                monitors_changed = true;
+                continue;
+            }
+            if (following && follow_handle_event(&follow, &ev))
+                continue;
+            for (int i = 0; i < panels_len && !panel_handle_xevent(&panels[i], &ev); i++)
+                ; /* NOP */
+        }
 
-    /* Read the output a line at a time - output it. */
-    while (fgets(status, max_status_len, (FILE *)status_data_pipe) != NULL) {
-        normalize_u8_string((signed char *)status, strlen(status));
-        
-        text_rect.w = 0;
-        text_rect.h = 0;
-        get_text_rect(drw, status, &text_rect);
-        set_alignment(&text_alignment, &text_rect, &panel_rect);
-        
-        XClearWindow(dpy, window);
-        drw_rect(drw, 0, 0, panel_rect.w, panel_rect.h, true, true);
-        drw_text(
-            drw,
-            text_rect.x, text_rect.y,
-            text_rect.w, text_rect.h,
-            0,  // align
-            status,
-            false  // invert color
-        );
-        drw_map(drw, window, 0, 0, panel_rect.w, panel_rect.h);
-        
-        XFlush(dpy);
+        /* a hotplug is a burst of events, the monitors are queried once for all of them */
+        if (monitors_changed) {
+            monitors_query(&monitor_table, dpy, screen);
+            for (int i = 0; i < panels_len; i++) {
+                Panel *panel = &panels[i];
+                /*
+                 * a panel on the focused monitor stays on the one it was put on while it
+                 * exists, found by its geometry as the indexes may have shifted; the pointer
+                 * picks a new one otherwise
+                 */
+                int preferred = panel->cfg->monitor >= 0
+                    ? panel->cfg->monitor
+                    : monitors_find(&monitor_table, &panel->screen_rect);
+                Rect screen_rect = decide_screen_rect(
+                    dpy, screen, preferred,
+                    monitors, &monitor_table, &panel->monitor
+                );
+                panel_set_screen(panel, &screen_rect);
+            }
+            /* monitor indexes may mean other monitors now */
+            follow.monitor = -1;
+            follow.pending = following;
+        }
+
+        if (following && follow_update(&follow, dpy, &monitor_table, monotonic_ms())) {
+            for (int i = 0; i < panels_len; i++) {
+                Panel *panel = &panels[i];
+                if (panel->cfg->monitor != MONITOR_ACTIVE || panel->monitor == follow.monitor)
+                    continue;
+                panel->monitor = follow.monitor;
+                panel_set_screen(panel, &monitor_table.rects[follow.monitor]);
+            }
+        }
+
+        if (stats_requested) {
+            stats_requested = 0;
+            stats_print(stderr);
+        }
+        if (quit_requested)
+            break;
+
+        /* socket clients come and go, so the set is rebuilt every time */
+        int fds_len = 0;
+        int timeout = -1;
+        bool running = false;
+        for (int i = 0; i < panels_len; i++) {
+            Panel *panel = &panels[i];
+            int timeouts[] = {panel_supervise(panel), panel_flush(panel, false)};
+
+            for (int t = 0; t < 2; t++)
+                if (timeouts[t] >= 0 && (timeout < 0 || timeouts[t] < timeout))
+                    timeout = timeouts[t];
+            running = running || panel->running;
+
+            panel_fds[i] = fds_len;
+            fds_len += panel_poll_fds(panel, fds + fds_len);
+        }
+        if (!running)
+            break;
+
+        if (following) {
+            int follow_at = follow_timeout(&follow, monotonic_ms());
+            if (follow_at >= 0 && (timeout < 0 || follow_at < timeout))
+                timeout = follow_at;
+        }
+
+        fds[fds_len].fd = ConnectionNumber(dpy);
+        fds[fds_len++].events = POLLIN;
+
+        if (poll(fds, fds_len, timeout) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+
+        for (int i = 0; i < panels_len; i++)
+            panel_dispatch(&panels[i], fds + panel_fds[i]);
     }
 
-    drw_free(drw);
-    free(scheme);
+    for (int i = 0; i < panels_len; i++) {
+        /* the last lines must not be lost to the frame cap */
+        panel_flush(&panels[i], true);
+        panel_destroy_window(&panels[i]);
+    }
+    for (int i = 0; i < fontsets_len; i++)
+        drw_fontset_free(fontsets[i].resource);
+    for (int i = 0; i < schemes_len; i++)
+        free(schemes[i].resource);
 
-    XDestroyWindow(dpy, window);
+    monitors_free(&monitor_table);
     XCloseDisplay(dpy);
 
+    /* commands may not write again soon, pclose would wait for them until then */
+    if (quit_requested) {
+        signal(SIGTERM, SIG_IGN);
+        kill(0, SIGTERM);
+    }
     on_close();
     return 0;
 }
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <X11/Xlib.h>
+#ifdef USE_XINERAMA
+    #include <X11/extensions/Xinerama.h>
+#endif
+#ifdef USE_XRANDR
+    #include <X11/extensions/Xrandr.h>
+#endif
+
+#include "monitors.h"
+#include "util.h"
+
+
+#ifdef USE_XRANDR
+static int
+query_randr(MonitorTable *table, Display *dpy, int screen)
+{
+    XRRMonitorInfo *infos;
+    int _dummy, len = 0, major, minor;
+
+    if (!XRRQueryExtension(dpy, &_dummy, &_dummy) || !XRRQueryVersion(dpy, &major, &minor))
+        return 0;
+    if (major < 1 || (major == 1 && minor < 5))
+        return 0;
+
+    infos = XRRGetMonitors(dpy, RootWindow(dpy, screen), True, &len);
+    if (!infos)
+        return 0;
+    if (len > 0) {
+        table->rects = ecalloc(len, sizeof(Rect));
+        for (int i = 0; i < len; i++) {
+            table->rects[i].x = infos[i].x;
+            table->rects[i].y = infos[i].y;
+            table->rects[i].w = infos[i].width;
+            table->rects[i].h = infos[i].height;
+        }
+    }
+    XRRFreeMonitors(infos);
+    return MAX(len, 0);
+}
+#endif
+
+#ifdef USE_XINERAMA
+static int
+query_xinerama(MonitorTable *table, Display *dpy)
+{
+    XineramaScreenInfo *screens;
+    int _dummy1, _dummy2, heads = 0;
+
+    if (!XineramaQueryExtension(dpy, &_dummy1, &_dummy2)) {
+        fprintf(stderr, "Xinerama not supported\n");
+        return 0;
+    }
+    if (!XineramaIsActive(dpy)) {
+        fprintf(stderr, "Xinerama not active\n");
+        return 0;
+    }
+    screens = XineramaQueryScreens(dpy, &heads);
+    if (!screens) {
+        fprintf(stderr, "XineramaQueryScreens failed\n");
+        return 0;
+    }
+    if (heads > 0) {
+        table->rects = ecalloc(heads, sizeof(Rect));
+        for (int i = 0; i < heads; i++) {
+            table->rects[i].x = screens[i].x_org;
+            table->rects[i].y = screens[i].y_org;
+            table->rects[i].w = screens[i].width;
+            table->rects[i].h = screens[i].height;
+        }
+    } else {
+        fprintf(stderr, "No screens found\n");
+    }
+    XFree(screens);
+    return MAX(heads, 0);
+}
+#endif
+
+int
+monitors_query(MonitorTable *table, Display *dpy, int screen)
+{
+    free(table->rects);
+    table->rects = NULL;
+    table->len = 0;
+
+#ifdef USE_XRANDR
+    table->len = query_randr(table, dpy, screen);
+#endif
+#ifdef USE_XINERAMA
+    if (!table->len)
+        table->len = query_xinerama(table, dpy);
+#endif
+
+    if (!table->len) {
+        table->rects = ecalloc(1, sizeof(Rect));
+        table->rects[0].w = DisplayWidth(dpy, screen);
+        table->rects[0].h = DisplayHeight(dpy, screen);
+        table->len = 1;
+    }
+    return table->len;
+}
+
+bool
+monitors_listen(MonitorTable *table, Display *dpy, int screen)
+{
+    table->rr_event_base = -1;
+#ifdef USE_XRANDR
+    int error_base;
+
+    if (!XRRQueryExtension(dpy, &table->rr_event_base, &error_base)) {
+        table->rr_event_base = -1;
+        return false;
+    }
+    /* outputs and CRTCs change without the root window changing size, e.g. a monitor moved */
+    XRRSelectInput(
+        dpy, RootWindow(dpy, screen),
+        RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask | RROutputChangeNotifyMask
+    );
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool
+monitors_handle_event(MonitorTable *table, XEvent *ev)
+{
+#ifdef USE_XRANDR
+    if (table->rr_event_base < 0)
+        return false;
+    if (ev->type == table->rr_event_base + RRScreenChangeNotify) {
+        /* keeps DisplayWidth and DisplayHeight up to date */
+        XRRUpdateConfiguration(ev);
+        return true;
+    }
+    return ev->type == table->rr_event_base + RRNotify;
+#else
+    return false;
+#endif
+}
+
+int
+monitors_at(const MonitorTable *table, int x, int y)
+{
+    for (int i = 0; i < table->len; i++) {
+        const Rect *r = &table->rects[i];
+        if (x >= r->x && x < r->x + r->w && y >= r->y && y < r->y + r->h)
+            return i;
+    }
+    return -1;
+}
+
+int
+monitors_find(const MonitorTable *table, const Rect *rect)
+{
+    for (int i = 0; i < table->len; i++) {
+        const Rect *r = &table->rects[i];
+        if (r->x == rect->x && r->y == rect->y && r->w == rect->w && r->h == rect->h)
+            return i;
+    }
+    return -1;
+}
+
+void
+monitors_free(MonitorTable *table)
+{
+    free(table->rects);
+    table->rects = NULL;
+    table->len = 0;
+}
@@ -0,0 +1,78 @@
+#ifndef MONITORS_H
+#define MONITORS_H
+
+#include <stdbool.h>
+#include <X11/Xlib.h>
+
+#include "geometry.h"
+
+/*
+ * The monitors of a screen, queried once and again only when RandR says the
+ * layout changed, so placing panels never costs a round trip on its own.
+ * Comes from RandR 1.5 monitors, Xinerama, or the whole screen as one
+ * monitor, whichever the build and the server have.
+ */
+
+typedef struct MonitorTable {
+    Rect *rects;
+    int len;
+    int rr_event_base;  // -1 without RandR, no changes are reported then
+} MonitorTable;
+
+/**
+ * Query the monitors, replacing what the table held
+ *
+ * @param table The table, zeroed before the first query
+ * @param dpy The display
+ * @param screen The screen number
+ * @return The number of monitors, at least 1
+ */
+int monitors_query(MonitorTable *table, Display *dpy, int screen);
+
+/**
+ * Ask for the events that tell the monitors changed
+ *
+ * @param table The table
+ * @param dpy The display
+ * @param screen The screen number
+ * @return false if RandR is not available
+ */
+bool monitors_listen(MonitorTable *table, Display *dpy, int screen);
+
+/**
+ * Take a RandR event
+ *
+ * The table is not queried again here: a hotplug comes as a burst of
+ * events, the caller queries once after the whole queue is read.
+ *
+ * @param table The table
+ * @param ev An event from the queue
+ * @return true if the event says the monitors may have changed
+ */
+bool monitors_handle_event(MonitorTable *table, XEvent *ev);
+
+/**
+ * The monitor a point is on
+ *
+ * @param table The table
+ * @param x The x in root window coordinates
+ * @param y The y in root window coordinates
+ * @return The monitor's index, -1 if the point is on none
+ */
+int monitors_at(const MonitorTable *table, int x, int y);
+
+/**
+ * The monitor with exactly this geometry
+ *
+ * Indexes change when monitors come and go, the geometry of the ones that
+ * stayed does not.
+ *
+ * @param table The table
+ * @param rect The geometry
+ * @return The monitor's index, -1 if no monitor has it
+ */
+int monitors_find(const MonitorTable *table, const Rect *rect);
+
+void monitors_free(MonitorTable *table);
+
+#endif /* MONITORS_H */
@@ -0,0 +1,553 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <X11/Xatom.h>
+
+#include "panel.h"
+#include "collectors.h"
+#include "stats.h"
+#include "util.h"
+
+
+int
+panel_open_sources(Panel *panel, const PanelConfig *cfg)
+{
+    int builtins_len = 0;
+    int commands_len = 0;
+
+    memset(panel, 0, sizeof(Panel));
+    panel->cfg = cfg;
+    panel->timer_fd = -1;
+    /* frames are timed in milliseconds, so more than 1000 per second means 1000 */
+    panel->interval = cfg->max_fps ? MAX(1000 / cfg->max_fps, 1u) : 0;
+    panel->segments = ecalloc(cfg->sources_len, sizeof(Segment));
+    panel->seg_fds = ecalloc(cfg->sources_len, sizeof(int));
+    panel->layouts = ecalloc(cfg->sources_len, sizeof(TextLayout));
+
+    for (; panel->segments_len < cfg->sources_len; panel->segments_len++) {
+        Segment *seg = &panel->segments[panel->segments_len];
+        const char *value = cfg->sources[panel->segments_len].value;
+
+        switch (cfg->sources[panel->segments_len].type) {
+            case SOURCE_COMMAND:
+                if (segment_open(seg, value, cfg->max_status_len, cfg->restart_delay_ms, cfg->restart_max_delay_ms) != 0) {
+                    printf("Failed to run the command: %s\n", value);
+                    return -1;
+                }
+                commands_len++;
+                break;
+            case SOURCE_BUILTIN:
+                if (segment_open_collector(seg, value) != 0) {
+                    printf("Failed to set up the built-in source: %s\n", value);
+                    return -1;
+                }
+                /* show something right away instead of waiting for the first tick */
+                segment_collect(seg);
+                builtins_len++;
+                break;
+            case SOURCE_SOCKET:
+                if (segment_open_socket(seg, value, cfg->max_status_len) != 0) {
+                    printf("Failed to listen on the socket: %s\n", value);
+                    return -1;
+                }
+                break;
+        }
+    }
+
+    if (builtins_len && (panel->timer_fd = collectors_timer_create(MAX(cfg->builtin_interval_ms, 1))) < 0) {
+        perror("timerfd");
+        return -1;
+    }
+
+    /* built-in sources and control sockets never finish, they keep the panel alive on their own */
+    panel->running = commands_len + (commands_len < panel->segments_len ? 1 : 0);
+    return 0;
+}
+
+void
+panel_close_sources(Panel *panel)
+{
+    for (int i = 0; i < panel->segments_len; i++)
+        segment_close(&panel->segments[i]);
+    if (panel->timer_fd >= 0) {
+        close(panel->timer_fd);
+        panel->timer_fd = -1;
+    }
+    panel->running = 0;
+}
+
+void
+panel_create_window(Panel *panel, Display *dpy, int screen, Rect *screen_rect)
+{
+    const PanelConfig *cfg = panel->cfg;
+    Window root_window = RootWindow(dpy, screen);
+
+    panel->rect = cfg->rect;
+    panel->screen_rect = *screen_rect;
+    set_alignment(&cfg->alignment, &panel->rect, screen_rect);
+    panel->rect.x += screen_rect->x;
+    panel->rect.y += screen_rect->y;
+
+    /* Create a simple window with a drawable. */
+    XSetWindowAttributes window_attributes = {
+        .override_redirect = True,
+    };
+    panel->window = XCreateWindow(
+        dpy,
+        root_window,  // parent
+        panel->rect.x, panel->rect.y,
+        panel->rect.w, panel->rect.h,
+        0,  // border width
+        DefaultDepth(dpy, screen),  // depth
+        InputOutput,  // class
+        DefaultVisual(dpy, screen),  // visual
+        CWOverrideRedirect,  // value mask
+        &window_attributes
+    );
+
+    /* set the name and class hints for the window manager to use */
+    XStoreName(dpy, panel->window, cfg->window_name);
+    XClassHint * class_hint = XAllocClassHint();
+    if (class_hint) {
+        class_hint->res_name = cfg->window_name;
+        class_hint->res_class = cfg->window_class;
+        XSetClassHint(dpy, panel->window, class_hint);
+        XFree(class_hint);
+    }
+    Atom win_type_atom = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", False);
+    Atom win_utility_atom = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_UTILITY", False);
+    XChangeProperty(
+        dpy, panel->window,
+        win_type_atom, XA_ATOM, 32,
+        PropModeReplace,
+        (unsigned char *)&win_utility_atom, 1
+    );
+
+    XSelectInput(dpy, panel->window, ExposureMask | StructureNotifyMask | PropertyChangeMask);
+    panel->fence_atom = XInternAtom(dpy, "_LIGHT_STATUS_FRAME", False);
+    XMapWindow(dpy, panel->window);
+
+    panel->drw = drw_create(dpy, screen, root_window, panel->rect.w, panel->rect.h);
+    if (panel->cfg->shm && !drw_shm_enable(panel->drw))
+        fprintf(stderr, "warning, MIT-SHM is not available, drawing on the X server\n");
+}
+
+void
+panel_set_screen(Panel *panel, const Rect *screen_rect)
+{
+    if (memcmp(screen_rect, &panel->screen_rect, sizeof(Rect)) == 0)
+        return;
+    panel->screen_rect = *screen_rect;
+
+    /* an auto-sized panel keeps its current size */
+    Rect rect = {.w = panel->rect.w, .h = panel->rect.h};
+    set_alignment(&panel->cfg->alignment, &rect, &panel->screen_rect);
+    rect.x += panel->screen_rect.x;
+    rect.y += panel->screen_rect.y;
+    if (rect.x == panel->rect.x && rect.y == panel->rect.y)
+        return;
+
+    panel->rect = rect;
+    XMoveWindow(panel->drw->dpy, panel->window, rect.x, rect.y);
+    stats.panel_moves++;
+}
+
+void
+panel_destroy_window(Panel *panel)
+{
+    if (!panel->drw)
+        return;
+
+    Display *dpy = panel->drw->dpy;
+
+    for (int i = 0; i < panel->segments_len; i++)
+        drw_layout_free(&panel->layouts[i]);
+
+    /* fonts and colors belong to whoever passed them to panel_set_resources */
+    drw_setfontset(panel->drw, NULL);
+    drw_free(panel->drw);
+    panel->drw = NULL;
+    XDestroyWindow(dpy, panel->window);
+}
+
+#define IS_UTF8_CONTINUATION(c) (((c) & 0xC0) == 0x80)
+
+static void
+set_segment_scheme(Panel *panel, Segment *seg)
+{
+    drw_set_scheme(panel->drw, seg->stale ? panel->scheme + 2 : panel->scheme);
+}
+
+/*
+ * Repaint only the bytes of a segment that differ from what is on the panel.
+ * The segment's width must not have changed, so the unchanged prefix and
+ * suffix stay where they are. The span is added to damage, the frame is
+ * copied to the window once all segments are drawn. Returns false if the
+ * damage can not be expressed as one span and the segment has to be drawn
+ * whole.
+ */
+static bool
+draw_segment_damage(Panel *panel, Segment *seg, TextLayout *layout, Rect *damage)
+{
+    Drw *drw = panel->drw;
+    Rect *row = &panel->text_rect;
+    const char *old = seg->drawn;
+    const char *new = seg->text;
+    size_t old_len = seg->drawn_len;
+    size_t new_len = seg->text_len;
+    size_t prefix = 0;
+    size_t suffix = 0;
+
+    while (prefix < old_len && prefix < new_len && old[prefix] == new[prefix])
+        prefix++;
+    while (
+        suffix < old_len - prefix && suffix < new_len - prefix
+        && old[old_len - 1 - suffix] == new[new_len - 1 - suffix]
+    )
+        suffix++;
+
+    /* Cut on codepoint boundaries and take one more character on each side,
+     * so glyphs overhanging into the damaged span are redrawn too. */
+    size_t start = prefix;
+    while (start > 0 && IS_UTF8_CONTINUATION(new[start]))
+        start--;
+    if (start > 0)
+        do start--; while (start > 0 && IS_UTF8_CONTINUATION(new[start]));
+
+    size_t end = new_len - suffix;
+    while (end < new_len && IS_UTF8_CONTINUATION(new[end]))
+        end++;
+    if (end < new_len)
+        do end++; while (end < new_len && IS_UTF8_CONTINUATION(new[end]));
+
+    int prefix_w = drw_layout_width(layout, 0, start);
+    int suffix_w = drw_layout_width(layout, end, new_len);
+
+    int span_w = seg->rect.w - prefix_w - suffix_w;
+    if (span_w < 0)
+        return false;
+    if (span_w == 0)
+        return true;
+
+    int span_x = row->x + seg->rect.x + prefix_w;
+    set_segment_scheme(panel, seg);
+    drw_text_layout(
+        drw,
+        span_x, row->y,
+        span_w, row->h,
+        new, layout,
+        start, end,
+        false  // invert color
+    );
+    /* segments come left to right, so the span never starts left of the damage */
+    Rect span = {.x = span_x, .y = row->y, .w = span_w, .h = row->h};
+    if (damage->w)
+        add_rect(damage, &span);
+    else
+        *damage = span;
+    return true;
+}
+
+static int
+round_up(int value, int step)
+{
+    return (value + step - 1) / step * step;
+}
+
+/*
+ * Fit an auto-sized window to the row of text. It grows right away, its width
+ * in whole steps so a few pixels more do not resize it every time, but only shrinks
+ * once the text has stayed smaller for autosize_shrink_ms. Returns true if
+ * the window and its pixmap got a new size.
+ */
+static bool
+panel_fit(Panel *panel, Rect *row, uint64_t now)
+{
+    const PanelConfig *cfg = panel->cfg;
+    int pad = cfg->autosize_padding * 2;
+    int step = MAX(cfg->autosize_step, 1);
+    /* the width jitters with the text, the height only changes with the fonts */
+    int w = MIN(round_up(MAX(row->w + pad, 1), step), cfg->rect.w);
+    int h = MIN(MAX(row->h + pad, 1), cfg->rect.h);
+
+    if (w > panel->rect.w || h > panel->rect.h) {
+        w = MAX(w, panel->rect.w);
+        h = MAX(h, panel->rect.h);
+    } else if (w < panel->rect.w || h < panel->rect.h) {
+        if (!panel->shrink_at)
+            panel->shrink_at = now + cfg->autosize_shrink_ms;
+        /* the first frame fits right away instead of starting at the largest size */
+        if (now < panel->shrink_at && panel->drawn)
+            return false;
+    } else {
+        panel->shrink_at = 0;
+        return false;
+    }
+    panel->shrink_at = 0;
+
+    Rect rect = {.w = w, .h = h};
+    set_alignment(&cfg->alignment, &rect, &panel->screen_rect);
+    rect.x += panel->screen_rect.x;
+    rect.y += panel->screen_rect.y;
+    panel->rect = rect;
+
+    XMoveResizeWindow(panel->drw->dpy, panel->window, rect.x, rect.y, rect.w, rect.h);
+    drw_resize(panel->drw, rect.w, rect.h);
+    stats.panel_resizes++;
+    return true;
+}
+
+static void
+panel_draw(Panel *panel)
+{
+    Drw *drw = panel->drw;
+    Rect *row = &panel->text_rect;
+    Rect old_row = *row;
+    bool full = !panel->drawn;
+    Segment *seg;
+    TextLayout *layout;
+
+    row->w = 0;
+    row->h = 0;
+    for (int i = 0; i < panel->segments_len; i++) {
+        seg = &panel->segments[i];
+        /* only the segments that got a new line are laid out again */
+        if (seg->dirty) {
+            int old_w = seg->rect.w;
+            bool was_truncated = panel->layouts[i].ellipsis;
+            bool was_styled = panel->layouts[i].styled;
+            /* no segment can be wider than the panel, the layout stops there */
+            drw_layout(
+                drw,
+                seg->text, seg->text_len,
+                panel->cfg->autosize ? MAX(panel->cfg->rect.w - (int)panel->cfg->autosize_padding * 2, 0) : panel->rect.w,
+                (seg->text_ascii ? LayoutAscii : 0) | (panel->cfg->markup ? LayoutMarkup : 0),
+                &panel->layouts[i]
+            );
+            seg->rect.w = panel->layouts[i].w;
+            seg->rect.h = panel->layouts[i].h;
+            full = full || seg->rect.w != old_w || seg->stale != seg->drawn_stale;
+            /* the ellipsis is not part of the text, damage can not be tracked around it */
+            full = full || was_truncated || panel->layouts[i].ellipsis;
+            /* nor around markup, a changed tag recolors text that stayed the same */
+            full = full || was_styled || panel->layouts[i].styled;
+        }
+        seg->rect.x = row->w;
+        row->w += seg->rect.w;
+        row->h = MAX(row->h, seg->rect.h);
+    }
+    if (panel->cfg->autosize && panel_fit(panel, row, monotonic_ms()))
+        full = true;
+    set_alignment(&panel->cfg->text_alignment, row, &panel->rect);
+    full = full || memcmp(row, &old_row, sizeof(Rect)) != 0;
+
+    if (!full) {
+        /* widths did not shift, so every change stays inside its own segment */
+        Rect damage = {0};
+        for (int i = 0; i < panel->segments_len; i++) {
+            seg = &panel->segments[i];
+            if (!seg->dirty)
+                continue;
+            if (!draw_segment_damage(panel, seg, &panel->layouts[i], &damage)) {
+                full = true;
+                break;
+            }
+            segment_mark_drawn(seg);
+        }
+        /* one copy for the whole frame, a shared image is put once and switches buffers once */
+        if (!full && damage.w)
+            drw_map(drw, panel->window, damage.x, damage.y, damage.w, damage.h);
+        stats.frames_partial += !full;
+    }
+
+    if (full) {
+        drw_rect(drw, 0, 0, panel->rect.w, panel->rect.h, true, true);
+        for (int i = 0; i < panel->segments_len; i++) {
+            seg = &panel->segments[i];
+            layout = &panel->layouts[i];
+            if (seg->dirty)
+                segment_mark_drawn(seg);
+            if (!seg->rect.w)
+                continue;
+            set_segment_scheme(panel, seg);
+            drw_text_layout(
+                drw,
+                row->x + seg->rect.x, row->y,
+                seg->rect.w, row->h,
+                seg->text, layout,
+                0, seg->text_len,
+                false  // invert color
+            );
+        }
+        drw_map(drw, panel->window, 0, 0, panel->rect.w, panel->rect.h);
+        panel->drawn = true;
+    }
+
+    /* No XSync: the frame is only handed to the server. With a limit on
+     * pending frames, a property change after the frame fences it instead,
+     * without a round trip. */
+    if (panel->cfg->max_pending_frames) {
+        long frame = stats.frames_drawn;
+        XChangeProperty(
+            drw->dpy, panel->window,
+            panel->fence_atom, XA_CARDINAL, 32,
+            PropModeReplace,
+            (unsigned char *)&frame, 1
+        );
+        panel->frames_pending++;
+    }
+    XFlush(drw->dpy);
+    panel->held = false;
+    stats.frames_drawn++;
+    stats_trace('f');
+}
+
+/* Too many frames are still on their way to the server, see PanelConfig.max_pending_frames */
+static bool
+panel_throttled(Panel *panel)
+{
+    return panel->cfg->max_pending_frames && panel->frames_pending >= panel->cfg->max_pending_frames;
+}
+
+static void
+panel_on_line(Segment *seg, void *ctx)
+{
+    Panel *panel = ctx;
+
+    if (!panel->interval && !panel_throttled(panel))
+        panel_draw(panel);
+}
+
+void
+panel_set_resources(Panel *panel, Fnt *fonts, Clr *scheme)
+{
+    drw_setfontset(panel->drw, fonts);
+    drw_set_scheme(panel->drw, scheme);
+    panel->scheme = scheme;
+
+    /* the pixmap is what Expose repaints from, so it must never hold garbage */
+    drw_rect(panel->drw, 0, 0, panel->rect.w, panel->rect.h, true, true);
+
+    /* built-in sources already have their first value */
+    panel_on_line(NULL, panel);
+}
+
+int
+panel_poll_fds(Panel *panel, struct pollfd *fds)
+{
+    int fds_len = 0;
+
+    for (int i = 0; i < panel->segments_len; i++) {
+        panel->seg_fds[i] = fds_len;
+        fds_len += segment_poll_fds(&panel->segments[i], fds + fds_len);
+    }
+    panel->timer_fd_index = fds_len;
+    if (panel->timer_fd >= 0) {
+        fds[fds_len].fd = panel->timer_fd;
+        fds[fds_len++].events = POLLIN;
+    }
+    return fds_len;
+}
+
+void
+panel_dispatch(Panel *panel, struct pollfd *fds)
+{
+    for (int i = 0; i < panel->segments_len; i++) {
+        Segment *seg = &panel->segments[i];
+        bool was_running = seg->fd >= 0;
+
+        /* drain everything the sources have written so far */
+        if (!segment_dispatch(seg, fds + panel->seg_fds[i], panel_on_line, panel) && was_running)
+            panel->running--;
+    }
+
+    if (
+        panel->timer_fd >= 0 && (fds[panel->timer_fd_index].revents & POLLIN)
+        && collectors_timer_read(panel->timer_fd, MAX(panel->cfg->builtin_interval_ms, 1))
+    ) {
+        bool changed = false;
+        for (int i = 0; i < panel->segments_len; i++)
+            if (panel->segments[i].collector)
+                changed = segment_collect(&panel->segments[i]) || changed;
+        if (changed)
+            panel_on_line(NULL, panel);
+    }
+}
+
+int
+panel_supervise(Panel *panel)
+{
+    uint64_t now = monotonic_ms();
+    int timeout = -1;
+
+    for (int i = 0; i < panel->segments_len; i++) {
+        int seg_timeout = segment_supervise(&panel->segments[i], now);
+        if (seg_timeout >= 0 && (timeout < 0 || seg_timeout < timeout))
+            timeout = seg_timeout;
+    }
+    return timeout;
+}
+
+int
+panel_flush(Panel *panel, bool force)
+{
+    bool dirty = false;
+    for (int i = 0; i < panel->segments_len; i++)
+        dirty = dirty || panel->segments[i].dirty;
+    if (!panel->drw)
+        return -1;
+
+    /* an auto-sized window shrinks when its text has been quiet long enough,
+     * that frame is held back like any other */
+    if (!dirty && !panel->shrink_at)
+        return -1;
+    uint64_t now = monotonic_ms();
+    if (!dirty && now < panel->shrink_at)
+        return panel->shrink_at - now;
+
+    /* the fence's PropertyNotify wakes up the loop again */
+    if (!force && panel_throttled(panel)) {
+        if (!panel->held)
+            stats.frames_throttled++;
+        panel->held = true;
+        return -1;
+    }
+
+    if (!force && now < panel->next_at)
+        return panel->next_at - now;
+
+    panel_draw(panel);
+    panel->next_at = now + panel->interval;
+    return -1;
+}
+
+bool
+panel_handle_xevent(Panel *panel, XEvent *ev)
+{
+    switch (ev->type) {
+        case Expose:
+            if (ev->xexpose.window != panel->window)
+                return false;
+            /* the pixmap always holds the last frame, so just copy the damaged area back */
+            drw_map(
+                panel->drw, panel->window,
+                ev->xexpose.x, ev->xexpose.y,
+                ev->xexpose.width, ev->xexpose.height
+            );
+            return true;
+        case PropertyNotify:
+            if (ev->xproperty.window != panel->window || ev->xproperty.atom != panel->fence_atom)
+                return false;
+            if (panel->frames_pending)
+                panel->frames_pending--;
+            return true;
+        case ConfigureNotify:
+            if (ev->xconfigure.window != panel->window)
+                return false;
+            panel->rect.x = ev->xconfigure.x;
+            panel->rect.y = ev->xconfigure.y;
+            return true;
+    }
+    return drw_handle_event(panel->drw, ev);
+}
@@ -0,0 +1,178 @@
+#ifndef PANEL_H
+#define PANEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <poll.h>
+#include <X11/Xlib.h>
+#include <X11/Xft/Xft.h>
+
+#include "drw.h"
+#include "geometry.h"
+#include "segment.h"
+
+typedef enum SourceType {
+    SOURCE_COMMAND,
+    SOURCE_BUILTIN,
+    SOURCE_SOCKET,
+} SourceType;
+
+typedef struct SourceSpec {
+    const char *value;
+    SourceType type;
+} SourceSpec;
+
+/* Everything one panel is made of, from the command line or a line of the panel list */
+typedef struct PanelConfig {
+    Rect rect;  // size and alignment offsets, relative to the screen
+    Alignment alignment;
+    Alignment text_alignment;
+    const char **fonts;
+    int fonts_len;
+    const char *colors[3];  // text, background, and stale text or NULL to draw it like the rest
+    char *window_name;
+    char *window_class;
+    int monitor;
+    bool markup;  // ^fg(), ^bg() and ^fn() in the text switch colors and fonts
+    unsigned int max_fps;
+    unsigned int max_pending_frames;  // 0 never waits for the X server
+    bool shm;  // rasterize on the client and present through MIT-SHM where the display allows it
+    bool autosize;  // the window follows the text, rect.w and rect.h are only the largest size
+    unsigned int autosize_padding;  // around the text, on every side
+    unsigned int autosize_step;  // the width changes in multiples of this many pixels
+    unsigned int autosize_shrink_ms;  // how long the text has to stay smaller before the window shrinks
+    unsigned int builtin_interval_ms;
+    unsigned int restart_delay_ms;  // 0 lets commands finish for good
+    unsigned int restart_max_delay_ms;
+    size_t max_status_len;
+    SourceSpec *sources;  // in the order they are shown
+    int sources_len;
+} PanelConfig;
+
+typedef struct Panel {
+    const PanelConfig *cfg;
+    Rect rect;  // the window, in root window coordinates
+    Rect screen_rect;  // the monitor the window is aligned in
+    int monitor;  // the index of that monitor in the monitor table, -1 for a -Xd spec
+    uint64_t shrink_at;  // when an auto-sized window gets smaller, 0 if it does not have to
+    Drw *drw;
+    Window window;
+    Clr *scheme;  // PANEL_SCHEME_LEN colors, see panel_set_resources
+
+    Segment *segments;
+    int segments_len;
+    TextLayout *layouts;  // each segment's text split into font runs, measured and drawn from
+    int *seg_fds;  // where each segment's entries start, see panel_poll_fds
+    int running;  // sources that can still produce lines
+    int timer_fd;  // drives the built-in sources, -1 without them
+    int timer_fd_index;
+
+    Rect text_rect;  // the row of all segments, aligned inside the panel
+    bool drawn;  // the pixmap holds a complete frame
+    uint64_t interval;  // 0 draws every line as soon as it arrives
+    uint64_t next_at;
+    Atom fence_atom;  // changed after every frame, its PropertyNotify says the server got that far
+    unsigned int frames_pending;  // frames sent whose fence has not come back
+    bool held;  // a due frame waits for frames_pending to go down, counted once in the stats
+} Panel;
+
+/* the normal text and background, then the ones for the last line of a stopped command */
+#define PANEL_SCHEME_LEN 4
+
+/* the most pollfds a panel needs, see panel_poll_fds */
+#define PANEL_MAX_FDS(panel) ((panel)->segments_len * SEGMENT_MAX_FDS + 1)
+
+/**
+ * Start the panel's commands, built-in sources and sockets
+ * 
+ * @param panel The panel to initialize
+ * @param cfg The panel's configuration, must outlive the panel
+ * @return 0 on success, -1 if a source could not be started
+ */
+int panel_open_sources(Panel *panel, const PanelConfig *cfg);
+
+/**
+ * Stop all sources of the panel
+ * 
+ * @param panel The panel
+ */
+void panel_close_sources(Panel *panel);
+
+/**
+ * Create and map the panel's window and drawable
+ * 
+ * @param panel The panel with its sources open
+ * @param dpy The display connection, possibly shared with other panels
+ * @param screen The screen number
+ * @param screen_rect The monitor the panel is aligned in
+ */
+void panel_create_window(Panel *panel, Display *dpy, int screen, Rect *screen_rect);
+
+/**
+ * Move the panel to where its alignment puts it on a monitor
+ * 
+ * Nothing is sent to the X server if the monitor's geometry is the one the
+ * panel is already on.
+ * 
+ * @param panel The panel with its window created
+ * @param screen_rect The monitor the panel is aligned in
+ */
+void panel_set_screen(Panel *panel, const Rect *screen_rect);
+
+/**
+ * Attach fonts and colors and paint the first frame
+ * 
+ * The panel does not own them, so they can be shared between panels.
+ * 
+ * @param panel The panel with its window created
+ * @param fonts The font set
+ * @param scheme PANEL_SCHEME_LEN colors
+ */
+void panel_set_resources(Panel *panel, Fnt *fonts, Clr *scheme);
+
+void panel_destroy_window(Panel *panel);
+
+/**
+ * Fill in the descriptors the panel waits on
+ * 
+ * @param panel The panel
+ * @param fds Room for at least PANEL_MAX_FDS(panel) entries
+ * @return The number of entries used
+ */
+int panel_poll_fds(Panel *panel, struct pollfd *fds);
+
+/**
+ * Read the sources that are ready and draw or schedule the new lines
+ * 
+ * @param panel The panel
+ * @param fds The entries filled by panel_poll_fds, after poll()
+ */
+void panel_dispatch(Panel *panel, struct pollfd *fds);
+
+/**
+ * Restart the commands whose backoff has passed
+ * 
+ * @param panel The panel
+ * @return The poll() timeout until the next restart, -1 if none is pending
+ */
+int panel_supervise(Panel *panel);
+
+/**
+ * Draw the pending lines if their frame is due
+ * 
+ * @param panel The panel
+ * @param force Ignore the frame rate cap
+ * @return The poll() timeout until the frame is due, -1 if nothing is pending
+ */
+int panel_flush(Panel *panel, bool force);
+
+/**
+ * Handle an X event if it is meant for the panel's window
+ * 
+ * @param panel The panel
+ * @param ev The event
+ * @return true if the event was for this panel
+ */
+bool panel_handle_xevent(Panel *panel, XEvent *ev);
+
+#endif /* PANEL_H */
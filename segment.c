@@ -0,0 +1,383 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "segment.h"
+#include "ctlsock.h"
+#include "stats.h"
+#include "utf8.h"
+#include "util.h"
+
+
+static void
+segment_init(Segment *seg)
+{
+    memset(seg, 0, sizeof(Segment));
+    seg->fd = -1;
+    seg->listen_fd = -1;
+    seg->text = "";
+    seg->text_ascii = true;
+}
+
+/* Make sure the owned text buffer holds at least size bytes */
+static void
+segment_own(Segment *seg, size_t size)
+{
+    if (seg->owned_size >= size)
+        return;
+    seg->owned_size = size;
+    if (!(seg->owned = realloc(seg->owned, size)))
+        die("realloc:");
+}
+
+static int
+segment_spawn(Segment *seg)
+{
+    seg->started_at = monotonic_ms();
+    if (!(seg->pipe = popen(seg->command, "r")))
+        return -1;
+
+    seg->fd = fileno(seg->pipe);
+    fcntl(seg->fd, F_SETFL, fcntl(seg->fd, F_GETFL) | O_NONBLOCK);
+    return 0;
+}
+
+int
+segment_open(
+    Segment *seg, const char *command, size_t max_line_len,
+    unsigned int restart_delay, unsigned int restart_max_delay
+)
+{
+    segment_init(seg);
+    seg->command = command;
+    seg->restart_min_delay = restart_delay;
+    seg->restart_max_delay = MAX(restart_max_delay, restart_delay);
+    seg->restart_delay = restart_delay;
+
+    if (segment_spawn(seg) != 0)
+        return -1;
+
+    linebuf_init(&seg->lines, max_line_len);
+    seg->text = linebuf_last(&seg->lines);
+    return 0;
+}
+
+static void
+segment_schedule_restart(Segment *seg)
+{
+    uint64_t now = monotonic_ms();
+
+    /* a command that ran for a while is not crash looping, start over from the shortest delay */
+    if (now - seg->started_at >= seg->restart_max_delay)
+        seg->restart_delay = seg->restart_min_delay;
+
+    fprintf(stderr, "'%s' stopped, restarting in %u ms\n", seg->command, seg->restart_delay);
+    seg->restart_at = now + seg->restart_delay;
+    seg->restart_delay = MIN(seg->restart_delay * 2, seg->restart_max_delay);
+}
+
+int
+segment_supervise(Segment *seg, uint64_t now)
+{
+    if (!seg->restart_at)
+        return -1;
+    if (now < seg->restart_at)
+        return seg->restart_at - now;
+
+    seg->restart_at = 0;
+    stats.commands_restarted++;
+    if (segment_spawn(seg) != 0) {
+        perror("popen");
+        segment_schedule_restart(seg);
+        return seg->restart_at - now;
+    }
+    return -1;
+}
+
+int
+segment_open_collector(Segment *seg, const char *spec)
+{
+    segment_init(seg);
+
+    if (!(seg->collector = collector_create(spec)))
+        return -1;
+
+    segment_own(seg, UTF8_NORMALIZED_SIZE(COLLECTOR_TEXT_SIZE));
+    return 0;
+}
+
+int
+segment_open_socket(Segment *seg, const char *path, size_t max_line_len)
+{
+    segment_init(seg);
+
+    if ((seg->listen_fd = ctlsock_listen(path)) < 0)
+        return -1;
+
+    seg->socket_path = path;
+    seg->client_max_line_len = max_line_len;
+    return 0;
+}
+
+static void
+segment_drop_client(Segment *seg, int index)
+{
+    close(seg->clients[index].fd);
+    linebuf_free(&seg->clients[index].lines);
+    seg->clients[index] = seg->clients[--seg->clients_len];
+}
+
+void
+segment_close(Segment *seg)
+{
+    if (seg->pipe) {
+        pclose(seg->pipe);
+        seg->pipe = NULL;
+    }
+    seg->fd = -1;
+    seg->restart_at = 0;
+
+    collector_free(seg->collector);
+    seg->collector = NULL;
+
+    while (seg->clients_len)
+        segment_drop_client(seg, seg->clients_len - 1);
+    if (seg->listen_fd >= 0) {
+        close(seg->listen_fd);
+        unlink(seg->socket_path);
+        seg->listen_fd = -1;
+    }
+
+    free(seg->owned);
+    seg->owned = NULL;
+    seg->owned_size = 0;
+
+    linebuf_free(&seg->lines);
+    seg->text = "";
+    seg->text_owned = false;
+
+    free(seg->drawn);
+    seg->drawn = NULL;
+    seg->drawn_len = seg->drawn_size = 0;
+}
+
+/* Returns false if the text is the same as the one already laid out or waiting for it */
+static bool
+segment_update_text(Segment *seg, const char *text, size_t len)
+{
+    uint64_t hash = hash_bytes(text, len);
+
+    seg->text = text;
+    stats.lines_read++;
+
+    if (hash == seg->text_hash && len == seg->text_len) {
+        stats.frames_skipped++;
+        /* a line waiting to be drawn is only on the screen once its frame is */
+        if (!seg->dirty)
+            stats_trace('s');
+        return false;
+    }
+    seg->text_hash = hash;
+    seg->text_len = len;
+
+    /* latest wins: a line nobody has laid out yet is dropped */
+    if (seg->dirty)
+        stats.lines_coalesced++;
+    seg->dirty = true;
+    return true;
+}
+
+bool
+segment_collect(Segment *seg)
+{
+    char text[COLLECTOR_TEXT_SIZE];
+    int len = collector_collect(seg->collector, text, sizeof(text));
+    len = len < 0 ? 0 : MIN(len, (int)sizeof(text) - 1);
+
+    /* formats come from the user and strftime follows the locale */
+    len = utf8_normalize(seg->owned, text, len, 0, &seg->text_ascii);
+    return segment_update_text(seg, seg->owned, len);
+}
+
+static void
+segment_take_line(Segment *seg, char *line, size_t len, SegmentLineHandler on_line, void *ctx)
+{
+    const char *text = line;
+
+    /* lines of printable ASCII, by far the most common, are used right where they are */
+    size_t prefix = utf8_printable_prefix(line, len);
+    seg->text_owned = prefix != len;
+    seg->text_ascii = !seg->text_owned;
+    if (seg->text_owned) {
+        segment_own(seg, UTF8_NORMALIZED_SIZE(len));
+        len = utf8_normalize(seg->owned, line, len, prefix, &seg->text_ascii);
+        text = seg->owned;
+    }
+
+    /* the restarted command's first line replaces the stale one even if it is the same */
+    bool was_stale = seg->stale;
+    seg->stale = false;
+
+    if (!segment_update_text(seg, text, len) && !was_stale)
+        return;
+    seg->dirty = true;
+    if (on_line)
+        on_line(seg, ctx);
+}
+
+static bool
+segment_read(Segment *seg, SegmentLineHandler on_line, void *ctx)
+{
+    bool running = seg->fd >= 0;
+    char *line;
+    size_t len;
+
+    while (running) {
+        ssize_t read_len = linebuf_fill(&seg->lines, seg->fd);
+        if (read_len < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            perror("read");
+            read_len = 0;
+        }
+        /* filling may have moved the newest line */
+        if (!seg->text_owned)
+            seg->text = linebuf_last(&seg->lines);
+
+        if (read_len == 0)
+            running = false;
+
+        /* Output the data a line at a time. */
+        while ((line = linebuf_next(&seg->lines, &len)) != NULL)
+            segment_take_line(seg, line, len, on_line, ctx);
+
+        if (!running && (line = linebuf_rest(&seg->lines, &len)) != NULL)
+            segment_take_line(seg, line, len, on_line, ctx);
+    }
+
+    if (!running && seg->fd >= 0) {
+        pclose(seg->pipe);
+        seg->pipe = NULL;
+        seg->fd = -1;
+
+        if (seg->restart_min_delay) {
+            segment_schedule_restart(seg);
+            /* keep showing the last line, drawn as stale */
+            seg->stale = true;
+            seg->dirty = true;
+            if (on_line)
+                on_line(seg, ctx);
+            return true;
+        }
+    }
+    return running;
+}
+
+/* Client lines die with the client's buffer, so they are copied into the segment */
+static void
+segment_take_client_line(Segment *seg, char *line, size_t len, SegmentLineHandler on_line, void *ctx)
+{
+    segment_own(seg, UTF8_NORMALIZED_SIZE(len));
+    len = utf8_normalize(seg->owned, line, len, 0, &seg->text_ascii);
+
+    if (segment_update_text(seg, seg->owned, len) && on_line)
+        on_line(seg, ctx);
+}
+
+/* Returns false once the client has disconnected */
+static bool
+segment_read_client(Segment *seg, SocketClient *client, SegmentLineHandler on_line, void *ctx)
+{
+    char *line;
+    size_t len;
+
+    while (true) {
+        ssize_t read_len = linebuf_fill(&client->lines, client->fd);
+        if (read_len < 0 && errno == EINTR)
+            continue;
+        if (read_len < 0 && errno == EAGAIN)
+            return true;
+
+        while ((line = linebuf_next(&client->lines, &len)) != NULL)
+            segment_take_client_line(seg, line, len, on_line, ctx);
+
+        if (read_len <= 0) {
+            if ((line = linebuf_rest(&client->lines, &len)) != NULL)
+                segment_take_client_line(seg, line, len, on_line, ctx);
+            return false;
+        }
+    }
+}
+
+int
+segment_poll_fds(Segment *seg, struct pollfd *fds)
+{
+    int len = 0;
+
+    if (seg->fd >= 0) {
+        fds[len].fd = seg->fd;
+        fds[len++].events = POLLIN;
+    }
+    if (seg->listen_fd >= 0) {
+        fds[len].fd = seg->listen_fd;
+        fds[len++].events = POLLIN;
+        for (int i = 0; i < seg->clients_len; i++) {
+            fds[len].fd = seg->clients[i].fd;
+            fds[len++].events = POLLIN;
+        }
+    }
+    return len;
+}
+
+bool
+segment_dispatch(Segment *seg, struct pollfd *fds, SegmentLineHandler on_line, void *ctx)
+{
+    const short ready = POLLIN | POLLHUP | POLLERR;
+
+    if (seg->fd >= 0)
+        return !(fds[0].revents & ready) || segment_read(seg, on_line, ctx);
+
+    if (seg->listen_fd < 0)
+        return true;
+
+    /* clients first, so indices still match what segment_poll_fds reported */
+    int polled_clients = seg->clients_len;
+    for (int i = polled_clients - 1; i >= 0; i--) {
+        if ((fds[1 + i].revents & ready) && !segment_read_client(seg, &seg->clients[i], on_line, ctx))
+            segment_drop_client(seg, i);
+    }
+
+    if (fds[0].revents & POLLIN) {
+        int fd;
+        while ((fd = ctlsock_accept(seg->listen_fd)) >= 0) {
+            if (seg->clients_len == SEGMENT_MAX_CLIENTS) {
+                fprintf(stderr, "error, too many clients on '%s'\n", seg->socket_path);
+                close(fd);
+                continue;
+            }
+            SocketClient *client = &seg->clients[seg->clients_len++];
+            client->fd = fd;
+            linebuf_init(&client->lines, seg->client_max_line_len);
+        }
+    }
+    return true;
+}
+
+void
+segment_mark_drawn(Segment *seg)
+{
+    if (seg->drawn_size < seg->text_len + 1) {
+        seg->drawn_size = seg->text_len + 1;
+        if (!(seg->drawn = realloc(seg->drawn, seg->drawn_size)))
+            die("realloc:");
+    }
+    memcpy(seg->drawn, seg->text, seg->text_len + 1);
+    seg->drawn_len = seg->text_len;
+    seg->drawn_stale = seg->stale;
+    seg->dirty = false;
+}
@@ -0,0 +1,161 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <poll.h>
+#include "geometry.h"
+#include "collectors.h"
+#include "linebuf.h"
+
+/* how many control socket clients one segment serves at once */
+#define SEGMENT_MAX_CLIENTS 16
+
+/* the most pollfds one segment needs, see segment_poll_fds */
+#define SEGMENT_MAX_FDS (1 + SEGMENT_MAX_CLIENTS)
+
+typedef struct SocketClient {
+    int fd;
+    LineBuf lines;
+} SocketClient;
+
+/* One data source and the part of the panel its output is drawn into */
+typedef struct Segment {
+    const char *command;
+    FILE *pipe;
+    int fd;  // -1 once the command has finished and for other sources
+
+    /* restarting the command when it stops, see segment_supervise */
+    unsigned int restart_min_delay;  // 0 lets the command finish for good
+    unsigned int restart_max_delay;
+    unsigned int restart_delay;  // the next backoff, doubles on every quick exit
+    uint64_t started_at;
+    uint64_t restart_at;  // 0 unless a restart is pending
+    bool stale;  // the command stopped, text is the last line it wrote
+
+    Collector *collector;  // set for built-in sources instead of command
+
+    const char *socket_path;  // set for control socket sources instead of command
+    int listen_fd;
+    SocketClient clients[SEGMENT_MAX_CLIENTS];
+    int clients_len;
+    size_t client_max_line_len;
+
+    LineBuf lines;  // command output, text points into it
+
+    /* text buffer for sources whose lines do not outlive the read */
+    char *owned;
+    size_t owned_size;
+
+    const char *text;  // newest complete line, normalized
+    uint64_t text_hash;  // identifies text, so repeated lines skip layout and drawing
+    size_t text_len;
+    bool text_ascii;  // text is pure ASCII, so it can be laid out a byte at a time
+    bool text_owned;  // text is in owned rather than in lines, for commands
+    bool dirty;  // text changed since the last layout
+    Rect rect;  // cached text size, x is the offset inside the segment row
+
+    char *drawn;  // copy of the text currently on the panel, to find what changed
+    size_t drawn_len;
+    size_t drawn_size;
+    bool drawn_stale;
+} Segment;
+
+typedef void (*SegmentLineHandler)(Segment *seg, void *ctx);
+
+/**
+ * Start the segment's command and prepare its buffers
+ * 
+ * When restart_delay is not 0, a command that stops is started again after
+ * restart_delay ms, doubling up to restart_max_delay while it keeps exiting
+ * quickly. Its last line stays on the panel, marked stale, in the meantime.
+ * 
+ * @param seg The segment to initialize
+ * @param command The command to run with popen()
+ * @param max_line_len Longer lines are cut
+ * @param restart_delay The first backoff in ms, 0 to never restart
+ * @param restart_max_delay The longest backoff in ms
+ * @return 0 on success, -1 if the command could not be started
+ */
+int segment_open(
+    Segment *seg, const char *command, size_t max_line_len,
+    unsigned int restart_delay, unsigned int restart_max_delay
+);
+
+/**
+ * Prepare a segment fed by a built-in source instead of a command
+ * 
+ * @param seg The segment to initialize
+ * @param spec The collector spec, see collector_create
+ * @return 0 on success, -1 if the source is unknown or unavailable
+ */
+int segment_open_collector(Segment *seg, const char *spec);
+
+/**
+ * Prepare a segment fed by clients of a listening control socket
+ * 
+ * @param seg The segment to initialize
+ * @param path Where to create the socket
+ * @param max_line_len Longer lines are cut
+ * @return 0 on success, -1 if the socket could not be created
+ */
+int segment_open_socket(Segment *seg, const char *path, size_t max_line_len);
+
+/**
+ * Update a built-in source segment, marking it dirty if the text changed
+ * 
+ * @param seg The segment to update
+ * @return true if the text changed
+ */
+bool segment_collect(Segment *seg);
+
+/**
+ * Start the command again once its backoff has passed
+ * 
+ * @param seg The segment
+ * @param now The monotonic_ms() time
+ * @return ms until the pending restart, -1 if there is none
+ */
+int segment_supervise(Segment *seg, uint64_t now);
+
+/**
+ * Stop the command and free the buffers
+ * 
+ * @param seg The segment to close
+ */
+void segment_close(Segment *seg);
+
+/**
+ * Fill in the descriptors the segment waits on
+ * 
+ * @param seg The segment
+ * @param fds Room for at least SEGMENT_MAX_FDS entries
+ * @return The number of entries used
+ */
+int segment_poll_fds(Segment *seg, struct pollfd *fds);
+
+/**
+ * Read everything the sources have written so far without blocking
+ * 
+ * Every complete line is normalized, see utf8_normalize, and becomes seg->text.
+ * Lines that differ from the previous one mark the segment dirty and are
+ * passed to on_line, repeated ones are only counted as skipped frames.
+ * 
+ * @param seg The segment to read
+ * @param fds The entries filled by segment_poll_fds, after poll()
+ * @param on_line Called after each new line, may be NULL
+ * @param ctx Passed to on_line
+ * @return false once the command has closed its output for good, control sockets never end
+ */
+bool segment_dispatch(Segment *seg, struct pollfd *fds, SegmentLineHandler on_line, void *ctx);
+
+/**
+ * Remember the current text as the one on the panel and clear the dirty flag
+ * 
+ * @param seg The segment that was drawn
+ */
+void segment_mark_drawn(Segment *seg);
+
+#endif /* SEGMENT_H */
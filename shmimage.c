@@ -0,0 +1,509 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shmimage.h"
+#include "stats.h"
+#include "util.h"
+
+#ifdef USE_XSHM
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+
+/* glyphs kept before the cache starts over, a status line uses a few dozen */
+#define GLYPHS_MAX 4096
+
+/* A rendered glyph, as a coverage mask placed relative to its origin */
+typedef struct ShmGlyph {
+    XftFont *font;  // NULL for a free slot
+    FT_UInt glyph;
+    int left, top;  // from the origin to the mask's top left corner
+    unsigned int w, h;
+    uint8_t *mask;  // w * h bytes, NULL for glyphs without ink
+} ShmGlyph;
+
+/* One of the two images frames alternate between */
+typedef struct ShmBuffer {
+    XImage *ximage;
+    XShmSegmentInfo info;
+    unsigned int pending;  // puts the server may still be reading this buffer for
+} ShmBuffer;
+
+struct ShmImage {
+    Display *dpy;
+    Visual *visual;
+    int depth;
+    int completion;  // event type of ShmCompletion
+    ShmBuffer buffers[2];
+    int current;  // the buffer drawn into and put
+    bool drawing;  // the current buffer changed since the last put
+
+    ShmGlyph *glyphs;  // open addressing by font and glyph
+    size_t glyphs_len;
+    size_t glyphs_size;
+};
+
+
+static bool attach_failed;
+
+static int
+attach_error(Display *dpy, XErrorEvent *ev)
+{
+    attach_failed = true;
+    return 0;
+}
+
+static void
+segment_destroy(ShmImage *img, ShmBuffer *buf)
+{
+    if (!buf->ximage)
+        return;
+    XShmDetach(img->dpy, &buf->info);
+    XDestroyImage(buf->ximage);
+    shmdt(buf->info.shmaddr);
+    buf->ximage = NULL;
+}
+
+/* Only runs at startup and on resize, so the round trip to learn whether the
+ * server could attach the segment is fine. */
+static bool
+segment_create(ShmImage *img, ShmBuffer *buf, unsigned int w, unsigned int h)
+{
+    buf->ximage = XShmCreateImage(img->dpy, img->visual, img->depth, ZPixmap, NULL, &buf->info, w, h);
+    if (!buf->ximage)
+        return false;
+    if (buf->ximage->bits_per_pixel != 32) {
+        XDestroyImage(buf->ximage);
+        buf->ximage = NULL;
+        return false;
+    }
+
+    buf->info.shmid = shmget(IPC_PRIVATE, (size_t)buf->ximage->bytes_per_line * h, IPC_CREAT | 0600);
+    if (buf->info.shmid < 0) {
+        XDestroyImage(buf->ximage);
+        buf->ximage = NULL;
+        return false;
+    }
+    buf->info.shmaddr = buf->ximage->data = shmat(buf->info.shmid, NULL, 0);
+    buf->info.readOnly = False;
+    /* the segment goes away once both sides have detached */
+    shmctl(buf->info.shmid, IPC_RMID, NULL);
+    if (buf->info.shmaddr == (char *)-1) {
+        XDestroyImage(buf->ximage);
+        buf->ximage = NULL;
+        return false;
+    }
+
+    /* remote servers can not see our memory and refuse the attach */
+    attach_failed = false;
+    XErrorHandler old = XSetErrorHandler(attach_error);
+    XShmAttach(img->dpy, &buf->info);
+    XSync(img->dpy, False);
+    XSetErrorHandler(old);
+    if (attach_failed) {
+        XDestroyImage(buf->ximage);
+        shmdt(buf->info.shmaddr);
+        buf->ximage = NULL;
+        return false;
+    }
+    return true;
+}
+
+static ShmBuffer *
+completed_buffer(ShmImage *img, XEvent *ev)
+{
+    if (ev->type != img->completion)
+        return NULL;
+    for (int i = 0; i < 2; i++)
+        if (((XShmCompletionEvent *)ev)->shmseg == img->buffers[i].info.shmseg)
+            return &img->buffers[i];
+    return NULL;
+}
+
+static Bool
+is_completion(Display *dpy, XEvent *ev, XPointer arg)
+{
+    return completed_buffer((ShmImage *)arg, ev) != NULL;
+}
+
+/* The server reads a buffer when it gets to a put, not when it is sent, so
+ * its pixels may only change once it says it is done. */
+static void
+wait_puts(ShmImage *img, ShmBuffer *buf)
+{
+    XEvent ev;
+
+    if (buf->pending)
+        stats.shm_waits++;
+    while (buf->pending) {
+        XIfEvent(img->dpy, &ev, is_completion, (XPointer)img);
+        ShmBuffer *done = completed_buffer(img, &ev);
+        if (done->pending)
+            done->pending--;
+    }
+}
+
+/*
+ * Called before every change to the pixels. The first change of a frame
+ * moves to the other buffer while the server still reads the current one,
+ * so a frame only waits when the server is two frames behind. Frames may
+ * redraw just their damage, the other buffer is brought up to date first.
+ */
+static ShmBuffer *
+begin_drawing(ShmImage *img)
+{
+    ShmBuffer *cur = &img->buffers[img->current];
+
+    if (img->drawing || !cur->pending) {
+        img->drawing = true;
+        return cur;
+    }
+
+    ShmBuffer *next = &img->buffers[!img->current];
+    wait_puts(img, next);
+    memcpy(next->ximage->data, cur->ximage->data, (size_t)cur->ximage->bytes_per_line * cur->ximage->height);
+    img->current = !img->current;
+    img->drawing = true;
+    return next;
+}
+
+static void
+buffers_destroy(ShmImage *img)
+{
+    for (int i = 0; i < 2; i++) {
+        wait_puts(img, &img->buffers[i]);
+        segment_destroy(img, &img->buffers[i]);
+    }
+}
+
+static bool
+buffers_create(ShmImage *img, unsigned int w, unsigned int h)
+{
+    img->current = 0;
+    img->drawing = false;
+    for (int i = 0; i < 2; i++) {
+        if (!segment_create(img, &img->buffers[i], w, h)) {
+            buffers_destroy(img);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void
+glyphs_clear(ShmImage *img)
+{
+    for (size_t i = 0; i < img->glyphs_size; i++)
+        free(img->glyphs[i].mask);
+    free(img->glyphs);
+    img->glyphs = NULL;
+    img->glyphs_len = 0;
+    img->glyphs_size = 0;
+}
+
+ShmImage *
+shmimage_create(Display *dpy, int screen, unsigned int w, unsigned int h)
+{
+    Visual *visual = DefaultVisual(dpy, screen);
+
+    if (!XShmQueryExtension(dpy))
+        return NULL;
+    /* pixels are blended as 8 bit channels in place */
+    if (
+        visual->class != TrueColor || DefaultDepth(dpy, screen) < 24
+        || visual->red_mask != 0xFF0000 || visual->green_mask != 0xFF00 || visual->blue_mask != 0xFF
+    )
+        return NULL;
+
+    ShmImage *img = ecalloc(1, sizeof(ShmImage));
+    img->dpy = dpy;
+    img->visual = visual;
+    img->depth = DefaultDepth(dpy, screen);
+    img->completion = XShmGetEventBase(dpy) + ShmCompletion;
+    if (!buffers_create(img, w, h)) {
+        free(img);
+        return NULL;
+    }
+    return img;
+}
+
+bool
+shmimage_resize(ShmImage *img, unsigned int w, unsigned int h)
+{
+    buffers_destroy(img);
+    return buffers_create(img, w, h);
+}
+
+void
+shmimage_free(ShmImage *img)
+{
+    if (!img)
+        return;
+    buffers_destroy(img);
+    glyphs_clear(img);
+    free(img);
+}
+
+void
+shmimage_clear_glyphs(ShmImage *img)
+{
+    if (img)
+        glyphs_clear(img);
+}
+
+void
+shmimage_fill(ShmImage *img, int x, int y, unsigned int w, unsigned int h, const XftColor *color)
+{
+    XImage *xi = img->buffers[img->current].ximage;
+    int x1 = MIN(x + (int)w, xi->width);
+    int y1 = MIN(y + (int)h, xi->height);
+
+    x = MAX(x, 0);
+    y = MAX(y, 0);
+    if (x >= x1 || y >= y1)
+        return;
+
+    xi = begin_drawing(img)->ximage;
+    for (int row = y; row < y1; row++) {
+        uint32_t *dst = (uint32_t *)(xi->data + (size_t)row * xi->bytes_per_line) + x;
+        for (int col = x; col < x1; col++)
+            *dst++ = color->pixel;
+    }
+}
+
+/* The load flags Xft derives from the font's pattern, so the glyphs are
+ * hinted and antialiased like the ones the server would draw. */
+static FT_Int32
+load_flags(XftFont *font, FT_Render_Mode *mode)
+{
+    FcBool antialias = FcTrue, hinting = FcTrue, autohint = FcFalse, bitmap = FcFalse, vertical = FcFalse;
+    int hint_style = FC_HINT_FULL;
+    FT_Int32 flags = FT_LOAD_DEFAULT;
+
+    FcPatternGetBool(font->pattern, FC_ANTIALIAS, 0, &antialias);
+    FcPatternGetBool(font->pattern, FC_HINTING, 0, &hinting);
+    FcPatternGetInteger(font->pattern, FC_HINT_STYLE, 0, &hint_style);
+    FcPatternGetBool(font->pattern, FC_AUTOHINT, 0, &autohint);
+    FcPatternGetBool(font->pattern, FC_EMBEDDED_BITMAP, 0, &bitmap);
+    FcPatternGetBool(font->pattern, FC_VERTICAL_LAYOUT, 0, &vertical);
+
+    if (antialias && !bitmap)
+        flags |= FT_LOAD_NO_BITMAP;
+    if (!hinting || hint_style == FC_HINT_NONE)
+        flags |= FT_LOAD_NO_HINTING;
+    if (autohint)
+        flags |= FT_LOAD_FORCE_AUTOHINT;
+    if (vertical)
+        flags |= FT_LOAD_VERTICAL_LAYOUT;
+
+    if (!antialias) {
+        flags |= FT_LOAD_TARGET_MONO;
+        *mode = FT_RENDER_MODE_MONO;
+    } else if (hint_style == FC_HINT_SLIGHT) {
+        flags |= FT_LOAD_TARGET_LIGHT;
+        *mode = FT_RENDER_MODE_LIGHT;
+    } else {
+        flags |= FT_LOAD_TARGET_NORMAL;
+        *mode = FT_RENDER_MODE_NORMAL;
+    }
+    return flags;
+}
+
+static void
+render_glyph(ShmGlyph *g)
+{
+    FT_Face face = XftLockFace(g->font);
+    FT_Bitmap *bitmap;
+    FT_Render_Mode mode;
+    FT_Int32 flags = load_flags(g->font, &mode);
+
+    if (!face)
+        return;
+    if (FT_Load_Glyph(face, g->glyph, flags) || FT_Render_Glyph(face->glyph, mode))
+        goto out;
+
+    bitmap = &face->glyph->bitmap;
+    if (
+        !bitmap->width || !bitmap->rows
+        || (bitmap->pixel_mode != FT_PIXEL_MODE_GRAY && bitmap->pixel_mode != FT_PIXEL_MODE_MONO)
+    )
+        goto out;
+
+    g->left = face->glyph->bitmap_left;
+    g->top = -face->glyph->bitmap_top;
+    g->w = bitmap->width;
+    g->h = bitmap->rows;
+    g->mask = ecalloc(g->w * g->h, 1);
+    for (unsigned int row = 0; row < g->h; row++) {
+        const uint8_t *src = bitmap->buffer + (ptrdiff_t)row * bitmap->pitch;
+        uint8_t *dst = g->mask + row * g->w;
+        if (bitmap->pixel_mode == FT_PIXEL_MODE_GRAY) {
+            memcpy(dst, src, g->w);
+        } else {
+            for (unsigned int col = 0; col < g->w; col++)
+                dst[col] = src[col >> 3] & (0x80 >> (col & 7)) ? 0xFF : 0;
+        }
+    }
+out:
+    XftUnlockFace(g->font);
+}
+
+static size_t
+glyph_hash(XftFont *font, FT_UInt glyph, size_t mask)
+{
+    return (((uintptr_t)font >> 4) * 0x9E3779B97F4A7C15ull ^ glyph * 2654435761u) & mask;
+}
+
+static ShmGlyph *
+glyph_get(ShmImage *img, XftFont *font, FT_UInt glyph)
+{
+    ShmGlyph *old, *g;
+    size_t i, mask, oldsize;
+
+    /* glyphs are only added, a line cycling through many of them starts over */
+    if (img->glyphs_len >= GLYPHS_MAX)
+        glyphs_clear(img);
+
+    /* keep the load under 3/4 so probing stays short */
+    if ((img->glyphs_len + 1) * 4 > img->glyphs_size * 3) {
+        old = img->glyphs;
+        oldsize = img->glyphs_size;
+        img->glyphs_size = oldsize ? oldsize * 2 : 256;
+        img->glyphs = ecalloc(img->glyphs_size, sizeof(ShmGlyph));
+        mask = img->glyphs_size - 1;
+        for (size_t j = 0; j < oldsize; j++) {
+            if (!old[j].font)
+                continue;
+            for (i = glyph_hash(old[j].font, old[j].glyph, mask); img->glyphs[i].font; i = (i + 1) & mask)
+                ; /* NOP */
+            img->glyphs[i] = old[j];
+        }
+        free(old);
+    }
+
+    mask = img->glyphs_size - 1;
+    for (i = glyph_hash(font, glyph, mask); img->glyphs[i].font; i = (i + 1) & mask)
+        if (img->glyphs[i].font == font && img->glyphs[i].glyph == glyph)
+            return &img->glyphs[i];
+
+    g = &img->glyphs[i];
+    g->font = font;
+    g->glyph = glyph;
+    img->glyphs_len++;
+    render_glyph(g);
+    return g;
+}
+
+static inline uint32_t
+blend(uint32_t dst, uint32_t src, unsigned int a)
+{
+    uint32_t out = 0;
+
+    for (int shift = 0; shift < 24; shift += 8) {
+        unsigned int d = (dst >> shift) & 0xFF;
+        unsigned int s = (src >> shift) & 0xFF;
+        out |= ((s * a + d * (255 - a) + 127) / 255) << shift;
+    }
+    return out | (dst & 0xFF000000);
+}
+
+void
+shmimage_glyphs(ShmImage *img, const XftColor *color, const XftGlyphFontSpec *specs, size_t len)
+{
+    XImage *xi = begin_drawing(img)->ximage;
+
+    for (size_t i = 0; i < len; i++) {
+        ShmGlyph *g = glyph_get(img, specs[i].font, specs[i].glyph);
+        if (!g->mask)
+            continue;
+
+        int gx = specs[i].x + g->left;
+        int gy = specs[i].y + g->top;
+        int col0 = MAX(0, -gx), col1 = MIN((int)g->w, xi->width - gx);
+        int row0 = MAX(0, -gy), row1 = MIN((int)g->h, xi->height - gy);
+
+        for (int row = row0; row < row1; row++) {
+            const uint8_t *src = g->mask + row * g->w;
+            uint32_t *dst = (uint32_t *)(xi->data + (size_t)(gy + row) * xi->bytes_per_line) + gx;
+            for (int col = col0; col < col1; col++) {
+                if (src[col] == 0xFF)
+                    dst[col] = color->pixel;
+                else if (src[col])
+                    dst[col] = blend(dst[col], color->pixel, src[col]);
+            }
+        }
+    }
+}
+
+void
+shmimage_put(ShmImage *img, Drawable dst, GC gc, int x, int y, unsigned int w, unsigned int h)
+{
+    ShmBuffer *buf = &img->buffers[img->current];
+
+    XShmPutImage(img->dpy, dst, gc, buf->ximage, x, y, x, y, w, h, True);
+    buf->pending++;
+    img->drawing = false;
+}
+
+bool
+shmimage_handle_event(ShmImage *img, XEvent *ev)
+{
+    ShmBuffer *buf = completed_buffer(img, ev);
+
+    if (!buf)
+        return false;
+    if (buf->pending)
+        buf->pending--;
+    return true;
+}
+
+#else
+
+/* built without MIT-SHM, every panel draws on the server */
+
+ShmImage *
+shmimage_create(Display *dpy, int screen, unsigned int w, unsigned int h)
+{
+    return NULL;
+}
+
+bool
+shmimage_resize(ShmImage *img, unsigned int w, unsigned int h)
+{
+    return false;
+}
+
+void
+shmimage_free(ShmImage *img)
+{
+}
+
+void
+shmimage_clear_glyphs(ShmImage *img)
+{
+}
+
+void
+shmimage_fill(ShmImage *img, int x, int y, unsigned int w, unsigned int h, const XftColor *color)
+{
+}
+
+void
+shmimage_glyphs(ShmImage *img, const XftColor *color, const XftGlyphFontSpec *specs, size_t len)
+{
+}
+
+void
+shmimage_put(ShmImage *img, Drawable dst, GC gc, int x, int y, unsigned int w, unsigned int h)
+{
+}
+
+bool
+shmimage_handle_event(ShmImage *img, XEvent *ev)
+{
+    return false;
+}
+
+#endif /* USE_XSHM */
@@ -0,0 +1,87 @@
+#ifndef SHMIMAGE_H
+#define SHMIMAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <X11/Xlib.h>
+#include <X11/Xft/Xft.h>
+
+/*
+ * A panel rasterized on the client into an image shared with the X server
+ * through MIT-SHM, so a frame is one XShmPutImage instead of fills, glyph
+ * uploads and a copy. Only works on local displays with a 24 bit TrueColor
+ * visual; everywhere else creating one fails and drawing stays on the server.
+ * Glyphs are rendered with FreeType as grayscale masks and cached per font.
+ * Frames alternate between two shared buffers, so drawing one does not wait
+ * for the server to finish reading the previous one.
+ */
+
+typedef struct ShmImage ShmImage;
+
+/**
+ * Create a shared image of the given size
+ *
+ * @param dpy The display, must be local
+ * @param screen The screen whose visual the image uses
+ * @param w The width
+ * @param h The height
+ * @return The image, or NULL if the display can not share memory with us
+ */
+ShmImage *shmimage_create(Display *dpy, int screen, unsigned int w, unsigned int h);
+
+/**
+ * Give the image a new size, its content is undefined afterwards
+ *
+ * @param img The image
+ * @param w The width
+ * @param h The height
+ * @return false if a new segment could not be attached, the image must be freed then
+ */
+bool shmimage_resize(ShmImage *img, unsigned int w, unsigned int h);
+
+void shmimage_free(ShmImage *img);
+
+/**
+ * Drop the cached glyphs, call it before the fonts they came from are freed
+ *
+ * @param img The image, may be NULL
+ */
+void shmimage_clear_glyphs(ShmImage *img);
+
+/**
+ * Fill a rectangle, clipped to the image
+ *
+ * @param img The image
+ * @param color The color, its pixel value is written as it is
+ */
+void shmimage_fill(ShmImage *img, int x, int y, unsigned int w, unsigned int h, const XftColor *color);
+
+/**
+ * Blend glyphs into the image, like XftDrawGlyphFontSpec does on a drawable
+ *
+ * @param img The image
+ * @param color The text color
+ * @param specs The glyphs with their fonts and baseline origins
+ * @param len The number of glyphs
+ */
+void shmimage_glyphs(ShmImage *img, const XftColor *color, const XftGlyphFontSpec *specs, size_t len);
+
+/**
+ * Queue a copy of a part of the image to a drawable, without waiting for it
+ *
+ * @param img The image
+ * @param dst The drawable, the rectangle is at the same place in it
+ * @param gc A GC for dst
+ */
+void shmimage_put(ShmImage *img, Drawable dst, GC gc, int x, int y, unsigned int w, unsigned int h);
+
+/**
+ * Take the completion event of a put
+ *
+ * @param img The image
+ * @param ev An event from the queue
+ * @return true if the event was the image's
+ */
+bool shmimage_handle_event(ShmImage *img, XEvent *ev);
+
+#endif /* SHMIMAGE_H */
@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <time.h>
+#include "stats.h"
+
+
+Stats stats;
+static FILE *trace;
+
+void
+stats_print(FILE *out)
+{
+    fprintf(out, "lines_read %" PRIu64 "\n", stats.lines_read);
+    fprintf(out, "lines_coalesced %" PRIu64 "\n", stats.lines_coalesced);
+    fprintf(out, "frames_drawn %" PRIu64 "\n", stats.frames_drawn);
+    fprintf(out, "frames_partial %" PRIu64 "\n", stats.frames_partial);
+    fprintf(out, "frames_skipped %" PRIu64 "\n", stats.frames_skipped);
+    fprintf(out, "frames_throttled %" PRIu64 "\n", stats.frames_throttled);
+    fprintf(out, "commands_restarted %" PRIu64 "\n", stats.commands_restarted);
+    fprintf(out, "advance_hits %" PRIu64 "\n", stats.advance_hits);
+    fprintf(out, "advance_misses %" PRIu64 "\n", stats.advance_misses);
+    fprintf(out, "panel_resizes %" PRIu64 "\n", stats.panel_resizes);
+    fprintf(out, "panel_moves %" PRIu64 "\n", stats.panel_moves);
+    fprintf(out, "shm_waits %" PRIu64 "\n", stats.shm_waits);
+    fflush(out);
+}
+
+void
+stats_trace_open(const char *path)
+{
+    if (!path || !path[0])
+        return;
+    if (!(trace = fopen(path, "w"))) {
+        perror("trace");
+        return;
+    }
+    /* written out at exit, not while frames are being timed */
+    setvbuf(trace, NULL, _IOFBF, 1 << 20);
+}
+
+void
+stats_trace(char kind)
+{
+    struct timespec ts;
+
+    if (!trace)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    fprintf(
+        trace, "%c %" PRIu64 " %" PRIu64 "\n",
+        kind, stats.lines_read, (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec
+    );
+}
@@ -0,0 +1,50 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Runtime counters, dumped to stderr on SIGUSR1 */
+typedef struct Stats {
+    uint64_t lines_read;
+    uint64_t lines_coalesced;
+    uint64_t frames_drawn;
+    uint64_t frames_partial;  // frames that repainted only the changed characters
+    uint64_t frames_skipped;  // lines identical to the one already shown
+    uint64_t frames_throttled;  // due frames that waited for the X server to catch up
+    uint64_t commands_restarted;
+    uint64_t advance_hits;  // words measured from the advance cache instead of Xft
+    uint64_t advance_misses;
+    uint64_t panel_resizes;  // auto-sized windows moved and resized to fit their text
+    uint64_t panel_moves;  // panels placed again after the monitors changed
+    uint64_t shm_waits;  // draws that waited for the server to finish reading both shared buffers
+} Stats;
+
+extern Stats stats;
+
+/**
+ * Print all counters as `key value` lines
+ * 
+ * @param out The stream to print to
+ */
+void stats_print(FILE *out);
+
+/**
+ * Write a line to the trace file for every frame, see stats_trace
+ * 
+ * Meant for `make bench`, which matches the trace against the times its
+ * producer wrote the lines at.
+ * 
+ * @param path Where to write, NULL or empty leaves tracing off
+ */
+void stats_trace_open(const char *path);
+
+/**
+ * Record that every line read so far is on the screen, as
+ * `<kind> <lines_read> <CLOCK_MONOTONIC ns>`
+ * 
+ * @param kind 'f' after a frame was handed to the X server, 's' for a skipped repeated line
+ */
+void stats_trace(char kind);
+
+#endif /* STATS_H */
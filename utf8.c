@@ -0,0 +1,162 @@
+#include <string.h>
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+    #define UTF8_X86
+    #include <immintrin.h>
+#endif
+
+#include "utf8.h"
+
+
+static size_t
+printable_prefix_scalar(const char *str, size_t len)
+{
+    size_t i = 0;
+
+    while (i < len && str[i] >= 0x20 && str[i] < 0x7F)
+        i++;
+    return i;
+}
+
+#ifdef UTF8_X86
+/* Bytes with the high bit set are negative as signed chars, so a single
+ * signed range check rejects them together with the control characters. */
+static size_t
+printable_prefix_sse2(const char *str, size_t len)
+{
+    const __m128i low = _mm_set1_epi8(0x1F);
+    const __m128i high = _mm_set1_epi8(0x7F);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(str + i));
+        __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, low), _mm_cmplt_epi8(v, high));
+        unsigned int mask = _mm_movemask_epi8(ok);
+        if (mask != 0xFFFF)
+            return i + __builtin_ctz(~mask);
+    }
+    return i + printable_prefix_scalar(str + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t
+printable_prefix_avx2(const char *str, size_t len)
+{
+    const __m256i low = _mm256_set1_epi8(0x1F);
+    const __m256i high = _mm256_set1_epi8(0x7F);
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(str + i));
+        __m256i ok = _mm256_and_si256(_mm256_cmpgt_epi8(v, low), _mm256_cmpgt_epi8(high, v));
+        unsigned int mask = _mm256_movemask_epi8(ok);
+        if (mask != 0xFFFFFFFF)
+            return i + __builtin_ctz(~mask);
+    }
+    return i + printable_prefix_sse2(str + i, len - i);
+}
+#endif
+
+size_t
+utf8_printable_prefix(const char *str, size_t len)
+{
+    static size_t (*impl)(const char *, size_t) = NULL;
+
+    if (!impl) {
+        impl = printable_prefix_scalar;
+#ifdef UTF8_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            impl = printable_prefix_avx2;
+        else if (__builtin_cpu_supports("sse2"))
+            impl = printable_prefix_sse2;
+#endif
+    }
+    return impl(str, len);
+}
+
+/* How long a sequence starting with lead is and the range its second byte must be in,
+ * which rules out overlong forms, surrogates and codepoints past U+10FFFF. 0 for bad leads. */
+static int
+sequence_len(unsigned char lead, unsigned char *lo, unsigned char *hi)
+{
+    *lo = 0x80;
+    *hi = 0xBF;
+    if (lead >= 0xC2 && lead <= 0xDF)
+        return 2;
+    if (lead >= 0xE0 && lead <= 0xEF) {
+        if (lead == 0xE0)
+            *lo = 0xA0;
+        else if (lead == 0xED)
+            *hi = 0x9F;
+        return 3;
+    }
+    if (lead >= 0xF0 && lead <= 0xF4) {
+        if (lead == 0xF0)
+            *lo = 0x90;
+        else if (lead == 0xF4)
+            *hi = 0x8F;
+        return 4;
+    }
+    return 0;
+}
+
+size_t
+utf8_normalize(char *dst, const char *src, size_t len, size_t prefix, bool *ascii)
+{
+    const unsigned char *s = (const unsigned char *)src;
+    bool only_ascii = true;
+    size_t i, out, run;
+
+    if (len && src[len - 1] == '\n')
+        len--;
+
+    out = i = prefix < len ? prefix : len;
+    memcpy(dst, src, i);
+
+    while (i < len) {
+        /* most lines are printable ASCII all the way, or for long stretches between
+         * the other characters */
+        if (s[i] >= 0x20 && s[i] < 0x7F) {
+            run = utf8_printable_prefix(src + i, len - i);
+            memcpy(dst + out, src + i, run);
+            out += run;
+            i += run;
+            continue;
+        }
+        /* the other ASCII characters are controls */
+        if (s[i] < 0x80) {
+            dst[out++] = ' ';
+            i++;
+            continue;
+        }
+        only_ascii = false;
+
+        unsigned char lo, hi;
+        int n = sequence_len(s[i], &lo, &hi);
+        int valid = n ? 1 : 0;
+        if (valid && i + 1 < len && s[i + 1] >= lo && s[i + 1] <= hi)
+            for (valid = 2; valid < n && i + valid < len && (s[i + valid] & 0xC0) == 0x80; valid++)
+                ; /* NOP */
+
+        if (n && valid == n) {
+            /* C1 controls draw as boxes just like C0 ones */
+            if (s[i] == 0xC2 && s[i + 1] < 0xA0) {
+                dst[out++] = ' ';
+            } else {
+                memcpy(dst + out, s + i, n);
+                out += n;
+            }
+            i += n;
+        } else {
+            /* one replacement for the lead and the continuation bytes that fit it */
+            memcpy(dst + out, UTF8_REPLACEMENT, 3);
+            out += 3;
+            i += valid ? valid : 1;
+        }
+    }
+    dst[out] = '\0';
+
+    if (ascii)
+        *ascii = only_ascii;
+    return out;
+}
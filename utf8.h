@@ -0,0 +1,40 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define UTF8_REPLACEMENT "\xEF\xBF\xBD"  // U+FFFD
+
+/* room utf8_normalize needs, every input byte may turn into U+FFFD */
+#define UTF8_NORMALIZED_SIZE(len) ((len) * 3 + 1)
+
+/**
+ * Length of the leading run of printable ASCII, which needs no normalizing
+ * 
+ * Uses AVX2 or SSE2 when the CPU has them, picked on the first call.
+ * 
+ * @param str The bytes to scan
+ * @param len How many
+ * @return The number of leading bytes between 0x20 and 0x7E
+ */
+size_t utf8_printable_prefix(const char *str, size_t len);
+
+/**
+ * Turn a line from a source into valid, drawable UTF-8
+ * 
+ * A trailing newline is dropped, other control characters, embedded
+ * newlines included, become spaces and every maximal invalid subsequence
+ * becomes U+FFFD. The result is NUL terminated.
+ * 
+ * @param dst Room for UTF8_NORMALIZED_SIZE(len) bytes, must not overlap src
+ * @param src The line
+ * @param len Its length
+ * @param prefix Leading bytes already known to be printable ASCII, from
+ *               utf8_printable_prefix, so they are not scanned again
+ * @param ascii Set to whether the result is pure ASCII, may be NULL
+ * @return The length of the result
+ */
+size_t utf8_normalize(char *dst, const char *src, size_t len, size_t prefix, bool *ascii);
+
+#endif /* UTF8_H */
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "util.h"
 
@@ -33,3 +34,64 @@ die(const char *fmt, ...) {
 
 	exit(1);
 }
+
+uint64_t
+monotonic_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* FNV-1a */
+uint64_t
+hash_bytes(const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (len--) {
+		hash ^= *p++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+#define IS_SEPARATOR(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
+
+/* Split a line into shell-like words in place, honouring quotes and backslashes.
+ * Line endings separate words too, so lines from getline can be passed as
+ * they are. Returns the number of words stored in args. */
+int
+split_args(char *line, const char **args, int max_args)
+{
+	char *src = line, *dst = line;
+	char quote;
+	int len = 0;
+
+	while (len < max_args) {
+		while (IS_SEPARATOR(*src))
+			src++;
+		/* only a whole line can be a comment, colors start with # too */
+		if (!*src || (*src == '#' && len == 0))
+			break;
+
+		args[len++] = dst;
+		for (quote = 0; *src && (quote || !IS_SEPARATOR(*src)); src++) {
+			if (!quote && (*src == '\'' || *src == '"'))
+				quote = *src;
+			else if (quote && *src == quote)
+				quote = 0;
+			else if (*src == '\\' && quote != '\'' && src[1])
+				*dst++ = *++src;
+			else
+				*dst++ = *src;
+		}
+		if (*src)
+			src++;
+		*dst++ = '\0';
+	}
+	return len;
+}
+
@@ -1,6 +1,7 @@
 /* See LICENSE file for copyright and license details. */
 
 #include <stddef.h>
+#include <stdint.h>
 
 #define MAX(A, B)               ((A) > (B) ? (A) : (B))
 #define MIN(A, B)               ((A) < (B) ? (A) : (B))
@@ -8,6 +9,9 @@
 
 void die(const char *fmt, ...);
 void *ecalloc(size_t nmemb, size_t size);
+uint64_t monotonic_ms(void);
+uint64_t hash_bytes(const void *data, size_t len);
+int split_args(char *line, const char **args, int max_args);
 
 
 #define C_RED     "\x1b[31m"